@@ -0,0 +1,42 @@
+#ifndef _AVH_H
+#define _AVH_H
+
+#include "subaru_levorg_vnx.h"
+
+
+// Warm restarts per drive (since the last engine stop) that may take over the preserved state
+#define AVH_WARM_MAX 3
+
+// Controller state, preserved in .noinit RAM across warm resets
+typedef struct _avh_state_
+{
+    param VnxParam;
+    eyesight PrevEyeSight;
+    enum avh_control_status AvhControlStatus;
+    enum prog_status ProgStatus;
+    uint16_t PreviousCanId;
+    uint8_t AvhControl;
+    uint8_t PrevAvhStatus;
+    uint8_t Retry;
+    uint8_t Led;
+    uint8_t RepressBrake;
+    uint8_t PrevSeatBelt;
+    uint8_t OffByBrake;
+    uint8_t warm_restarts; // Warm restarts since the last engine stop
+    float PrevSpeed;
+    float PrevBrake;
+    float MaxBrake;
+    uint32_t crc;          // system_crc32() over all fields above
+} avh_state_t;
+
+
+// Prototypes
+void avh_init(void);
+void avh_process(CAN_RxHeaderTypeDef *rx_msg_header, uint8_t *rx_msg_data);
+void avh_save(avh_state_t *copy);
+void avh_restore(const avh_state_t *copy);
+uint8_t avh_engine_stopped(void);
+void avh_led(void);
+void led_blink(uint8_t Status);
+
+#endif // _AVH_H
@@ -1,9 +1,12 @@
 #ifndef _AVHCONTROLLER_H
 #define _AVHCONTROLLER_H
 
-int8_t avhcontroller_parse_str(uint8_t *buf, uint8_t len);
+int8_t avhcontroller_parse(const uint8_t *buf, uint32_t len);
 
-// maximum rx buffer len: command length from USB CDC port
-#define AVHCONTROLLER_MTU 1 // (sizeof("V"))
+// maximum number of arguments of a command from USB CDC port
+#define AVHCONTROLLER_MAX_ARGS 4
+
+// time bound of the USB throughput benchmark (B) in ms, well within the IWDG timeout
+#define AVHCONTROLLER_BENCH_TIMEOUT 2000
 
 #endif // _AVHCONTROLLER_H
@@ -0,0 +1,27 @@
+#ifndef _BOOT_H
+#define _BOOT_H
+
+
+// Boot profile checkpoints, in the order main() passes them
+enum boot_mark {
+    BOOT_RESET = 0,   // main() entered (GPIO only, the clock is not up yet)
+    BOOT_CLOCK,       // 48 MHz clock and SysTick running
+    BOOT_CAN,         // HAL_CAN_Start done, frames are being received
+    BOOT_STORE,       // Journal and calibration loaded
+    BOOT_USB,         // LEDs and USB initialized
+    BOOT_FIRST_FRAME, // First frame taken by the main loop
+
+    BOOT_MARK_MAX
+};
+
+// Scope probe pin toggled at every mark (build with BOOT_PROFILE=1)
+#define BOOT_MARK_Pin GPIO_PIN_1
+#define BOOT_MARK_Port GPIOB
+
+
+// Prototypes
+void boot_mark(enum boot_mark mark);
+uint8_t boot_reached(enum boot_mark mark);
+void boot_report(void);
+
+#endif // _BOOT_H
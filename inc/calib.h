@@ -0,0 +1,51 @@
+#ifndef _CALIB_H
+#define _CALIB_H
+
+
+// Calibration parameters (index used by the C command)
+enum calib_param {
+    CALIB_BRAKE_HIGH = 0,  // Brake pressure to enable AVH (%)
+    CALIB_BRAKE_LOW,       // Brake pressure to disable AVH (%)
+    CALIB_MAX_RETRY,       // Maximum number of AVH control retries
+    CALIB_RETRY_DELAY,     // Delay before each AVH control transmit (ms)
+    CALIB_SUM_CHECK_ADDER, // Checksum adder of the AVH control frame
+    CALIB_BITRATE,         // CAN bitrate (enum can_bitrate), -1: autobaud at boot
+
+    CALIB_MAX
+};
+
+// Increment when the layout or meaning of the stored values changes
+#define CALIB_VERSION 2
+
+// Flash record: one copy of all parameters, appended on every write
+typedef struct _calib_record_
+{
+    uint16_t version;         // CALIB_VERSION
+    uint16_t seq;             // Write sequence number, highest valid record wins
+    int16_t value[CALIB_MAX]; // Parameter values
+    uint16_t reserved;
+    uint32_t crc;             // CRC-32 over the fields above
+} calib_record_t;
+
+// Working copy in RAM, converted once to the types used on the hot path
+typedef struct _calib_
+{
+    float brake_high;
+    float brake_low;
+    uint16_t retry_delay;
+    uint8_t max_retry;
+    int8_t sum_check_adder;
+    int8_t bitrate;
+} calib_t;
+
+extern calib_t calib;
+
+
+// Prototypes
+void calib_init(void);
+int16_t calib_get(uint8_t param);
+int8_t calib_set(uint8_t param, int16_t value);
+int8_t calib_restore_defaults(void);
+void calib_print(void);
+
+#endif // _CALIB_H
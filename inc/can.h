@@ -15,6 +15,35 @@ enum can_bitrate {
 	CAN_BITRATE_INVALID,
 };
 
+// Bit timing, computed at compile time from the CAN kernel clock and a target
+// sample point. The bit is split into 16 tq where the clock allows an exact
+// prescaler (all standard bitrates at 48 MHz), 20, 12, 24, 10 or 8 tq otherwise.
+// Sample point = (1 + TSEG1) / tq. Invalid combinations fail the build (can.c).
+#ifndef CAN_CLOCK_HZ
+#define CAN_CLOCK_HZ 48000000 // PCLK, SYSCLK is HSI48 in both oscillator builds
+#endif
+#ifndef CAN_SAMPLE_POINT
+#define CAN_SAMPLE_POINT 875 // Permille of the bit time
+#endif
+
+#define CAN_BT_FITS(br, tq) (CAN_CLOCK_HZ % ((br) * (tq)) == 0 && CAN_CLOCK_HZ / ((br) * (tq)) <= 1024)
+#define CAN_BT_TQ(br) (CAN_BT_FITS(br, 16) ? 16 : CAN_BT_FITS(br, 20) ? 20 : CAN_BT_FITS(br, 12) ? 12 : \
+                       CAN_BT_FITS(br, 24) ? 24 : CAN_BT_FITS(br, 10) ? 10 : 8)
+#define CAN_BT_BRP(br) (CAN_CLOCK_HZ / ((br) * CAN_BT_TQ(br)))
+#define CAN_BT_TSEG1(br) ((CAN_BT_TQ(br) * CAN_SAMPLE_POINT + 500) / 1000 - 1)
+#define CAN_BT_TSEG2(br) (CAN_BT_TQ(br) - 1 - CAN_BT_TSEG1(br))
+#define CAN_BT_SJW(br) (CAN_BT_TSEG2(br) < 4 ? CAN_BT_TSEG2(br) : 4)
+
+// Autobaud: listening time per candidate bitrate (ms), frames needed to lock
+#define CAN_AUTOBAUD_DWELL 50
+#define CAN_AUTOBAUD_FRAMES 4
+
+// bxCAN limits
+#define CAN_TSEG1_MAX 16
+#define CAN_TSEG2_MAX 8
+#define CAN_SJW_MAX 4
+#define CAN_BRP_MAX 1024
+
 typedef enum can_bus_state {
     OFF_BUS = 0,
     ON_BUS = 1,
@@ -22,7 +51,7 @@ typedef enum can_bus_state {
 
 
 // CAN transmit buffering
-#define TXQUEUE_LEN 28 // Number of buffers allocated
+#define TXQUEUE_LEN 16 // Number of buffers allocated
 #define TXQUEUE_DATALEN 8 // CAN DLC length of data buffers
 
 typedef struct cantxbuf_
@@ -35,13 +64,42 @@ typedef struct cantxbuf_
 } can_txbuf_t;
 
 
+// CAN receive buffering: filled from the RX FIFO0 interrupt, drained by the main loop
+#define RXRING_LEN 16 // Number of frames buffered
+
+typedef struct canrxframe_
+{
+	uint32_t id; // StdId or ExtId
+	uint8_t ide; // CAN_ID_STD or CAN_ID_EXT
+	uint8_t rtr; // CAN_RTR_DATA or CAN_RTR_REMOTE
+	uint8_t dlc;
+	uint8_t data[8];
+	uint32_t timestamp; // can_timestamp() when the frame was taken from the FIFO
+} can_rxframe_t;
+
+typedef struct canrxring_
+{
+	can_rxframe_t frame[RXRING_LEN];
+	volatile uint8_t head; // Written by the CAN ISR only
+	volatile uint8_t tail; // Written by the main loop only
+	volatile uint32_t dropped; // Frames lost because the ring was full
+} can_rxring_t;
+
+
 // Prototypes
 void can_init(void);
 void can_enable(void);
 void can_disable(void);
 void can_set_bitrate(enum can_bitrate bitrate);
+int8_t can_set_bittiming(uint32_t brp, uint8_t tseg1, uint8_t tseg2, uint8_t sjw);
 void can_set_silent(uint8_t silent);
+void can_set_loopback(uint8_t loopback);
 void can_set_autoretransmit(uint8_t autoretransmit);
+void can_set_accept_all(uint8_t accept_all);
+enum can_bitrate can_autobaud(uint8_t *locked);
+void can_sleep(void);
+void can_wakeup(void);
+void can_wake_stats(uint32_t *count, uint32_t *latency);
 uint32_t can_tx(CAN_TxHeaderTypeDef *tx_msg_header, uint8_t *tx_msg_data);
 uint32_t can_rx(CAN_RxHeaderTypeDef *rx_msg_header, uint8_t *rx_msg_data);
 
@@ -49,6 +107,13 @@ uint32_t can_rx(CAN_RxHeaderTypeDef *rx_msg_header, uint8_t *rx_msg_data);
 void can_process(void);
 
 uint8_t is_can_msg_pending(uint8_t fifo);
+uint8_t can_rx_depth(void);
+uint32_t can_rx_dropped(void);
+uint32_t can_timestamp(void);
+void can_isr_cycles(uint32_t *last, uint32_t *max);
+void can_rx_latency(uint32_t *last, uint32_t *max);
+void can_rx_isr(void);
+void can_error_sample(void);
 CAN_HandleTypeDef* can_gethandle(void);
 
 #endif // _CAN_H
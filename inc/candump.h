@@ -0,0 +1,15 @@
+#ifndef _CANDUMP_H
+#define _CANDUMP_H
+
+
+// Longest line: "# (" + 10 digit tick + ".000) can0 " + 8 digit ID + '#' + 16 data + '\n'
+#define CANDUMP_MTU 56
+
+
+// Prototypes
+uint8_t candump_encode_rx(const CAN_RxHeaderTypeDef *rx_msg_header, const uint8_t *rx_msg_data, uint8_t *out);
+uint8_t candump_encode_tx(const CAN_TxHeaderTypeDef *tx_msg_header, const uint8_t *tx_msg_data, uint32_t tick, uint8_t *out);
+void candump_rx_frame(const CAN_RxHeaderTypeDef *rx_msg_header, const uint8_t *rx_msg_data);
+void candump_tx_frame(const CAN_TxHeaderTypeDef *tx_msg_header, const uint8_t *tx_msg_data);
+
+#endif // _CANDUMP_H
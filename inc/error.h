@@ -10,15 +10,37 @@ typedef enum _error_t
 	ERR_CANRXFIFO_OVERFLOW,
 	ERR_FULLBUF_CANTX,
 	ERR_FULLBUF_USBRX,
+	ERR_FULLBUF_CANRX,
+	ERR_LOOP_DEADLINE,
+	ERR_CAN_PASSIVE,
+	ERR_CAN_BUSOFF,
+	ERR_FLASH,
 
 	ERR_MAX
 } error_t;
 
 
+// bxCAN fault confinement state
+typedef enum _can_err_state_
+{
+	CAN_ERR_ACTIVE = 0,
+	CAN_ERR_WARNING,  // TEC or REC >= 96
+	CAN_ERR_PASSIVE,  // TEC or REC > 127
+	CAN_ERR_BUSOFF,   // TEC > 255, recovers after 128 x 11 recessive bits (AutoBusOff)
+} can_err_state_t;
+
+// LEC values 1..6 of CAN_ESR: stuff, form, acknowledgment, bit recessive, bit dominant, CRC
+#define CAN_LEC_TYPES 6
+
+
 // Prototypes
 void error_assert(error_t err);
 uint32_t error_timestamp(error_t err);
 uint8_t error_occurred(error_t err);
 uint32_t error_reg(void);
+void error_can_lec(uint8_t lec);
+void error_can_state(uint32_t esr);
+uint8_t error_can_passive(void);
+void error_can_report(void);
 
 #endif /* INC_ERROR_H_ */
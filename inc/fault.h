@@ -0,0 +1,34 @@
+#ifndef _FAULT_H
+#define _FAULT_H
+
+
+// Exception that captured the record
+enum fault_source {
+    FAULT_NONE = 0,
+    FAULT_HARDFAULT,
+    FAULT_NMI,
+};
+
+// Crash record, kept in .noinit RAM across the reset that follows the fault
+typedef struct _fault_record_
+{
+    uint32_t magic;
+    uint32_t source;  // enum fault_source
+    uint32_t pc;      // Stacked PC: the faulting instruction
+    uint32_t lr;      // Stacked LR: return address of the faulting function
+    uint32_t xpsr;    // Stacked xPSR (IPSR: exception active at the fault)
+    uint32_t sp;      // SP of the faulting code, before stacking
+    uint32_t err_reg; // error_reg() at the time of the fault
+    uint32_t tick;    // HAL_GetTick() at the time of the fault
+    uint32_t crc;     // system_crc32() over all fields above
+} fault_record_t;
+
+#define FAULT_MAGIC 0xFA017ED0
+
+
+// Prototypes
+void fault_capture(uint32_t *frame, uint32_t source) __attribute__((noreturn));
+void fault_init(void);
+void fault_report(void);
+
+#endif // _FAULT_H
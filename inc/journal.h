@@ -0,0 +1,51 @@
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+
+// Event IDs recorded in the flash journal (keep in sync with tools/journal_decode.py)
+enum journal_event {
+    EVT_BOOT = 0x01,          // a: RCC_CSR reset flags >> 24
+    EVT_ENGINE_START,
+    EVT_ENGINE_STOP,
+    EVT_AVH_SUCCEEDED,        // a: AvhStatus, b: Retry
+    EVT_AVH_HOLD_RELEASED,    // a: RepressBrake, b: OffByBrake
+    EVT_AVH_OFF_CANCELLED,    // a: Retry, b: Brake(%)
+    EVT_AVH_HOLD_FAILED,      // a: RepressBrake, b: OffByBrake
+    EVT_AVH_FAILED,           // a: AvhControl, b: Retry
+    EVT_CONTROL_CANCELLED,
+    EVT_CONTROL_RESTARTED,    // a: AvhStatus
+    EVT_ERROR,                // a: error_t bit, b: error_reg() low byte
+    EVT_WARM_RESTART,         // a: AvhControlStatus, b: warm restarts since engine stop
+    EVT_FAULT,                // a: fault_source (bit 7: PC in RAM), b: error_reg() low byte
+    EVT_FAULT_PC,             // a: PC bits 15..8, b: PC bits 7..0
+    EVT_FAULT_LR,             // a: LR bits 15..8, b: LR bits 7..0
+    EVT_AUTOBAUD,             // a: detected can_bitrate (CAN_BITRATE_INVALID: none), b: locked (stored)
+    EVT_AVH_ON_WITHDRAWN,     // a: Retry, b: Speed(km/h, 255: above)
+
+    EVT_MAX
+};
+
+
+// One journal record: 8 bytes, programmed as a single double word
+typedef struct _journal_record_
+{
+    uint32_t tick;  // HAL_GetTick() at the time of the event
+    uint8_t event;  // enum journal_event
+    uint8_t a;      // Event specific signal value
+    uint8_t b;      // Event specific signal value
+    uint8_t check;  // Checksum over the 7 bytes above
+} journal_record_t;
+
+// RAM staging buffer (records waiting to be programmed)
+#define JOURNAL_STAGE_LEN 8
+
+
+// Prototypes
+void journal_init(void);
+void journal_log(uint8_t event, uint8_t a, uint8_t b);
+void journal_process(void);
+uint8_t journal_pending(void);
+void journal_dump(void);
+uint32_t journal_dropped(void);
+
+#endif // _JOURNAL_H
@@ -0,0 +1,14 @@
+#ifndef _LOOPBACK_H
+#define _LOOPBACK_H
+
+
+// Frames in flight (bounded by the 3 TX mailboxes), and the time limit of one
+// run (ms), well below the 4 s watchdog
+#define LOOPBACK_INFLIGHT 3
+#define LOOPBACK_TIMEOUT 2000
+
+
+// Prototypes
+int8_t loopback_bench(uint32_t count);
+
+#endif // _LOOPBACK_H
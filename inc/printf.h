@@ -61,6 +61,12 @@ void _putchar(char character);
 int printf_(const char* format, ...);
 
 
+/**
+ * Number of characters printf_() dropped because the host did not drain the USB TX ring
+ */
+uint32_t printf_truncated(void);
+
+
 /**
  * Tiny sprintf implementation
  * Due to security reasons (buffer overflow) YOU SHOULD CONSIDER USING (V)SNPRINTF INSTEAD!
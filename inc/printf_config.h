@@ -0,0 +1,24 @@
+#ifndef _PRINTF_CONFIG_H
+#define _PRINTF_CONFIG_H
+
+//
+// printf_config: minimal printf_ profile for the 32K flash part
+//
+// Included by printf.c through -DPRINTF_INCLUDE_CONFIG_H (see Makefile).
+// All callers split floats into "%d.%02d" themselves, so the double precision
+// _ftoa/_etoa (and the soft-float library behind them) are only built with
+// "make PRINTF_FLOAT=1". Nothing prints 64-bit or ptrdiff_t values.
+//
+
+#ifndef PRINTF_FLOAT
+#define PRINTF_DISABLE_SUPPORT_FLOAT
+#define PRINTF_DISABLE_SUPPORT_EXPONENTIAL
+#endif
+
+#define PRINTF_DISABLE_SUPPORT_LONG_LONG
+#define PRINTF_DISABLE_SUPPORT_PTRDIFF_T
+
+// 32-bit values only: 10 digits, sign and a little zero padding
+#define PRINTF_NTOA_BUFFER_SIZE    16U
+
+#endif // _PRINTF_CONFIG_H
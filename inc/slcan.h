@@ -0,0 +1,16 @@
+#ifndef _SLCAN_H
+#define _SLCAN_H
+
+
+// Longest SLCAN line: 'T' + 8 ID + DLC + 16 data + '\r'
+#define SLCAN_MTU 27
+
+
+// Prototypes
+uint8_t slcan_encode(const CAN_RxHeaderTypeDef *rx_msg_header, const uint8_t *rx_msg_data, uint8_t *out);
+void slcan_frame(const CAN_RxHeaderTypeDef *rx_msg_header, const uint8_t *rx_msg_data);
+void slcan_set_enabled(uint8_t enabled);
+uint8_t slcan_enabled(void);
+void slcan_report(void);
+
+#endif // _SLCAN_H
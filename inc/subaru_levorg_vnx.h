@@ -1,6 +1,8 @@
 #ifndef __SUBARU_LEVORG_VNX_H__
 #define __SUBARU_LEVORG_VNX_H__
 
+#include "calib.h"
+
 /* #define for DEBUG_MODE */
 #define no_printf_(fmt, ...)                 \
 ({                                           \
@@ -48,10 +50,12 @@ typedef struct{
 } param;
 
 // Brake Pressure to Enable AVH
-#define BRAKE_HIGH 60
+#define BRAKE_HIGH_DEFAULT 60
+#define BRAKE_HIGH calib.brake_high
 
 // Brake Pressure to Disable AVH
-#define BRAKE_LOW  10
+#define BRAKE_LOW_DEFAULT  10
+#define BRAKE_LOW  calib.brake_low
 
 // AVH CONTROL STATUS
 enum avh_control_status {
@@ -91,8 +95,24 @@ enum prog_status {
 #define SHIFT_P 4
 
 // for Calculate Check Sum
-#define SUM_CHECK_ADDER (-0x3F)
+#define SUM_CHECK_ADDER_DEFAULT (-0x3F)
+#define SUM_CHECK_ADDER calib.sum_check_adder
+
+#define MAX_RETRY_DEFAULT 5
+#define MAX_RETRY calib.max_retry
+
+// Delay before each AVH control transmit (ms)
+#define RETRY_DELAY_DEFAULT 50
+#define RETRY_DELAY calib.retry_delay
+
+// CAN bitrate (enum can_bitrate), -1: detect at boot and store the result
+#define BITRATE_DEFAULT (-1)
+#define BITRATE calib.bitrate
+
+// Minimum interval between AVH control attempts while the CAN node is error passive (ms)
+#define PASSIVE_TX_INTERVAL 1000
 
-#define MAX_RETRY 5
+// Bus silence after engine stop before entering Stop mode (ms)
+#define PARK_TIMEOUT 5000
 
 #endif /* __SUBARU_LEVORG_VNX_H_ */
@@ -0,0 +1,26 @@
+#ifndef _SUPERVISOR_H
+#define _SUPERVISOR_H
+
+
+// Main loop budget per iteration (us), longer iterations count as deadline misses
+#define SUPERVISOR_BUDGET_US 2000
+
+// Loop latency histogram: bucket 0 is below 125 us, each further bucket doubles,
+// the last one holds everything from 8 ms up
+#define SUPERVISOR_BUCKETS 8
+
+// IWDG timeout: LSI (~40 kHz) / 64 * 2500 = 4 s, above the longest legitimate
+// stall (two RETRY_DELAY waits of at most 1 s each in the AVH retry path)
+#define SUPERVISOR_IWDG_PR 4 // Divider 64
+#define SUPERVISOR_IWDG_RLR 2500
+
+
+// Prototypes
+void supervisor_start(void);
+uint8_t supervisor_running(void);
+void supervisor_loop_begin(void);
+void supervisor_loop_end(void);
+void supervisor_delay(uint32_t ms);
+void supervisor_report(void);
+
+#endif // _SUPERVISOR_H
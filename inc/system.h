@@ -2,10 +2,30 @@
 #define _SYSTEM_H
 
 
+// Run a function from SRAM, without flash wait states: it is linked into .ramfunc
+// and copied together with .data by the startup code. Build with RAMFUNC=0 to run
+// the same code from flash for comparison.
+#ifdef RAMFUNC_DISABLE
+#define RAMFUNC
+#else
+#define RAMFUNC __attribute__((section(".ramfunc"), noinline))
+#endif
+
+
 void system_init(void);
+void system_crs_init(void);
+void system_clock_restore(void);
+void system_stop(void);
 void system_hex32(char *out, uint32_t val);
 void system_irq_enable(void);
 void system_irq_disable(void);
+uint32_t system_crc32(const void *data, uint32_t len);
+uint32_t system_cycles(void);
+void system_idle(uint8_t (*work_pending)(void));
+uint8_t system_idle_percent(void);
+void system_stack_paint(void);
+uint32_t system_stack_free(void);
+void system_ram_report(void);
 
 
 #endif
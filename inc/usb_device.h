@@ -96,6 +96,9 @@ void usb_init(void);
 /** USB Device stop function. */
 void usb_stop(void);
 
+/** Returns 1 if a host has configured the device. */
+uint8_t usb_configured(void);
+
 /**
   * @}
   */
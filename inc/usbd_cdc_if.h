@@ -7,6 +7,8 @@
 #define TX_BUF_SIZE  64 // Linear TX buf size
 #define NUM_RX_BUFS 6 // Number of RX buffers in FIFO
 #define RX_BUF_SIZE CDC_DATA_FS_MAX_PACKET_SIZE // Size of RX buffer item
+#define TX_RING_SIZE 256 // Batched TX ring size
+#define TX_RING_MAX_XFER 128 // Maximum bytes per USB transfer from the TX ring
 
 // Receive buffering: circular buffer FIFO
 typedef struct _usbrx_buf_
@@ -14,8 +16,8 @@ typedef struct _usbrx_buf_
 	// Receive buffering: circular buffer FIFO
 	uint8_t buf[NUM_RX_BUFS][RX_BUF_SIZE];
 	uint32_t msglen[NUM_RX_BUFS];
-	uint8_t head;
-	uint8_t tail;
+	uint8_t head; // Written by the USB ISR only
+	uint8_t tail; // Written by the main loop only
 
 } usbrx_buf_t;
 
@@ -26,7 +28,11 @@ extern USBD_CDC_ItfTypeDef USBD_Interface_fops_FS;
 
 // Prototypes
 uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
+uint16_t cdc_tx_write(const uint8_t* Buf, uint16_t Len);
+uint8_t cdc_tx_putc(uint8_t c);
+void cdc_tx_process(void);
 void cdc_process(void);
+uint8_t cdc_rx_pending(void);
 
 
 #endif /* __USBD_CDC_IF_H__ */
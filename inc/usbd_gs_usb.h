@@ -0,0 +1,81 @@
+#ifndef __USBD_GS_USB_H__
+#define __USBD_GS_USB_H__
+
+#include "usbd_ioreq.h"
+
+// Endpoints (fixed by the Linux gs_usb driver)
+#define GS_USB_IN_EP  0x81
+#define GS_USB_OUT_EP 0x02
+#define GS_USB_PACKET_SIZE 64
+
+#define GS_USB_CONFIG_DESC_SIZ 32
+#define GS_USB_QUEUE_LEN 8 // Frames waiting for the IN endpoint
+
+// Vendor control requests
+enum gs_usb_breq {
+    GS_USB_BREQ_HOST_FORMAT = 0,
+    GS_USB_BREQ_BITTIMING,
+    GS_USB_BREQ_MODE,
+    GS_USB_BREQ_BERR,
+    GS_USB_BREQ_BT_CONST,
+    GS_USB_BREQ_DEVICE_CONFIG,
+    GS_USB_BREQ_TIMESTAMP,
+    GS_USB_BREQ_IDENTIFY,
+};
+
+#define GS_CAN_MODE_RESET 0
+#define GS_CAN_MODE_START 1
+
+#define GS_CAN_FEATURE_HW_TIMESTAMP (1 << 4) // Also used as GS_CAN_MODE_HW_TIMESTAMP flag
+#define GS_CAN_FLAG_OVERFLOW (1 << 0)
+
+// SocketCAN can_id flags
+#define GS_CAN_EFF_FLAG 0x80000000
+#define GS_CAN_RTR_FLAG 0x40000000
+
+#define GS_HOST_FRAME_ECHO_RX 0xFFFFFFFF // echo_id of received (not echoed) frames
+
+
+// Frame record exchanged on the bulk endpoints
+typedef struct _gs_host_frame_
+{
+    uint32_t echo_id;   // GS_HOST_FRAME_ECHO_RX, or the host's id for TX confirmation
+    uint32_t can_id;    // CAN ID with GS_CAN_EFF_FLAG / GS_CAN_RTR_FLAG
+    uint8_t can_dlc;
+    uint8_t channel;
+    uint8_t flags;      // GS_CAN_FLAG_*
+    uint8_t reserved;
+    uint8_t data[8];
+    uint32_t timestamp_us; // Only sent when the host enabled hardware timestamps
+} gs_host_frame_t;
+
+// Class state (allocated through USBD_malloc like the CDC handle)
+typedef struct _gs_usb_handle_
+{
+    gs_host_frame_t queue[GS_USB_QUEUE_LEN];
+    uint8_t head;          // Written by the main loop only
+    volatile uint8_t tail; // Written by the USB ISR only (IN transfer complete)
+    volatile uint8_t in_busy;
+    gs_host_frame_t rx;    // OUT endpoint buffer
+    volatile uint8_t rx_pending; // Host frame waiting for the main loop
+    uint8_t ctrl_req;      // Vendor request waiting for its data stage
+    uint32_t ctrl[10];     // Control data stage (largest is BT_CONST)
+    volatile uint8_t mode_pending;
+    uint8_t bt_pending;    // Bit timing received, applied at the next start
+    uint32_t bt[5];        // prop_seg, phase_seg1, phase_seg2, sjw, brp
+    uint32_t mode;
+    uint32_t flags;
+    uint8_t started;
+    uint8_t overflow;      // A frame was lost in the IN queue
+    uint32_t rx_dropped;   // can_rx_dropped() already reported to the host
+} gs_usb_handle_t;
+
+
+extern USBD_ClassTypeDef USBD_GS_USB;
+
+
+// Prototypes
+void gs_usb_frame(const CAN_RxHeaderTypeDef *rx_msg_header, const uint8_t *rx_msg_data);
+void gs_usb_process(void);
+
+#endif /* __USBD_GS_USB_H__ */
@@ -0,0 +1,520 @@
+//
+// avh: AVH (Auto Vehicle Hold) decision logic, one received frame at a time
+//
+// All controller state lives in one struct in the .noinit RAM section, sealed
+// with a CRC after every frame. After a watchdog, fault or software reset the
+// state is taken over as it was, so control resumes with the next frame
+// instead of waiting for the engine start sequence again. A power-on reset, a
+// bad CRC, a stopped engine or AVH_WARM_MAX warm restarts since the engine
+// last stopped (per drive, not in a row) start from scratch.
+//
+
+#include "stm32f0xx_hal.h"
+#include <stddef.h>
+#include <string.h>
+#include "can.h"
+#include "led.h"
+#include "system.h"
+#include "error.h"
+#include "printf.h"
+#include "journal.h"
+#include "calib.h"
+#include "slcan.h"
+#include "candump.h"
+#include "usbd_gs_usb.h"
+#include "supervisor.h"
+#include "avh.h"
+#include "subaru_levorg_vnx.h"
+
+
+// Controller state, kept across warm resets
+static avh_state_t state __attribute__((section(".noinit")));
+static uint32_t PassiveTxTick = 0;
+
+
+static void transmit_can_frame(uint8_t* rx_msg_data, uint8_t avh){
+    // Storage for transmit message buffer
+    CAN_TxHeaderTypeDef tx_msg_header;
+    tx_msg_header.IDE = CAN_ID_STD;
+    tx_msg_header.StdId = CAN_ID_AVH_CONTROL;
+    tx_msg_header.ExtId = 0;
+    tx_msg_header.RTR = CAN_RTR_DATA;
+    tx_msg_header.DLC = 8;
+    uint8_t tx_msg_data[8] = {0};
+
+    if((rx_msg_data[1] & 0x0f) == 0x0f){
+        tx_msg_data[1] = rx_msg_data[1] &= 0xf0;
+    } else {
+        tx_msg_data[1] = rx_msg_data[1] += 0x01;
+    }
+
+    if(avh){
+        tx_msg_data[2] = rx_msg_data[2] | 0x02; // Introduce auto behicle hold bit on
+    } else {
+        tx_msg_data[2] = rx_msg_data[2] | 0x01; // Remove auto behicle hold bit on
+    }
+        
+    tx_msg_data[3] = rx_msg_data[3];
+    tx_msg_data[4] = rx_msg_data[4];
+    tx_msg_data[5] = rx_msg_data[5];
+    tx_msg_data[6] = rx_msg_data[6];
+    tx_msg_data[7] = rx_msg_data[7];
+    // Calculate checksum
+    tx_msg_data[0] = (tx_msg_data[1] +
+                      tx_msg_data[2] +
+                      tx_msg_data[3] +
+                      tx_msg_data[4] +
+                      tx_msg_data[5] +
+                      tx_msg_data[6] +
+                      tx_msg_data[7]) + SUM_CHECK_ADDER;
+    can_tx(&tx_msg_header, tx_msg_data); // Queueing message
+    can_process(); // Transmit message
+#ifdef DEBUG_MODE
+    candump_tx_frame(&tx_msg_header, tx_msg_data);
+#endif
+}
+
+
+static void init_param(param* VnxParam){
+    VnxParam->AvhStatus = AVH_OFF;
+    VnxParam->ParkBrake = ON;
+    VnxParam->SeatBelt = OPEN;
+    VnxParam->Door = OPEN;
+    VnxParam->EyeSight.Switch = OFF;
+    VnxParam->EyeSight.Acc = OFF;
+    VnxParam->EyeSight.Ready = OFF;
+    VnxParam->EyeSight.Hold = UNHOLD;
+    VnxParam->Gear = SHIFT_P;
+    VnxParam->Speed = 0;
+    VnxParam->Brake = 0;
+    VnxParam->Accel = 0;
+}
+
+
+static void print_param(param* VnxParam, uint8_t AvhControl, float PrevSpeed, float PrevBrake, float MaxBrake){
+#if 0
+    dprintf_("# DEBUG Speed:%d.%02d(%d.%02d)km/h\n", (int)VnxParam->Speed, (int)(VnxParam->Speed * 100) % 100, (int)PrevSpeed, (int)(PrevSpeed * 100) % 100);
+    dprintf_("# DEBUG Accel:%d.%02d%%\n", (int)VnxParam->Accel, (int)(VnxParam->Accel * 100) % 100);
+    dprintf_("# DEBUG Brake:%d.%02d(%d.%02d)%% / MAX: %d.%02d%%\n", (int)VnxParam->Brake, (int)(VnxParam->Brake * 100) % 100, (int)PrevBrake, (int)(PrevBrake * 100) % 100, (int)MaxBrake, (int)(MaxBrake * 100) % 100);
+    dprintf_("# DEBUG Gear:%d(1:D,2:N,3:R,4:P)\n", VnxParam->Gear);
+    dprintf_("# DEBUG ParkBrake:%d(0:OFF,1:ON)\n", VnxParam->ParkBrake);
+    dprintf_("# DEBUG AVH:%d(0:OFF,1:ON,3:HOLD)=>%d\n", VnxParam->AvhStatus, AvhControl);
+    dprintf_("# DEBUG Door:%d(0:CLOSE,1:OPEN)\n", VnxParam->Door);
+    dprintf_("# DEBUG Belt:%d(0:CLOSE,1:OPEN)\n", VnxParam->SeatBelt);
+    dprintf_("# DEBUG EyeSight(HOLD):%d(0:OFF,1:ON)\n", VnxParam->EyeSightHold);
+#endif
+}
+
+
+// Show AVH status (green) and requested control (orange)
+void led_blink(uint8_t Status){
+    if(Status & 1){
+        led_orange_on();
+    } else {
+        led_orange_off();
+    }
+    if(Status & 2){
+        led_green_on();
+    } else {
+        led_green_off();
+    }
+}
+
+
+// Start from scratch: engine stopped, nothing requested
+static void avh_reset(void)
+{
+    memset(&state, 0, sizeof(state));
+    state.AvhControlStatus = ENGINE_STOP;
+    state.ProgStatus = PROCESSING;
+    state.PreviousCanId = CAN_ID_AVH_CONTROL;
+    state.AvhControl = AVH_OFF;
+    state.PrevAvhStatus = AVH_OFF;
+    state.Retry = 0;
+    state.Led = OFF;
+    state.RepressBrake = OFF;
+    state.PrevSeatBelt = OPEN;
+    state.PrevSpeed = 0;
+    state.PrevBrake = 0;
+    state.MaxBrake = 0;
+    state.PrevEyeSight.Switch = OFF;
+    state.PrevEyeSight.Acc = OFF;
+    state.PrevEyeSight.Ready = OFF;
+    state.PrevEyeSight.Hold = UNHOLD;
+    state.OffByBrake = OFF;
+    init_param(&state.VnxParam);
+}
+
+
+// Recalculate the CRC after the state has changed
+static void avh_seal(void)
+{
+    state.crc = system_crc32(&state, offsetof(avh_state_t, crc));
+}
+
+
+// Take over the preserved state on a warm reset, start from scratch otherwise.
+// Must run before the reset flags are cleared.
+void avh_init(void)
+{
+    if(!(RCC->CSR & RCC_CSR_PORRSTF) && state.crc == system_crc32(&state, offsetof(avh_state_t, crc)) &&
+       state.AvhControlStatus != ENGINE_STOP && state.warm_restarts < AVH_WARM_MAX){
+        state.warm_restarts++;
+        journal_log(EVT_WARM_RESTART, state.AvhControlStatus, state.warm_restarts);
+        supervisor_start();
+    } else {
+        avh_reset();
+    }
+    avh_seal();
+}
+
+
+// Copy the controller state out, e.g. before a benchmark feeds synthetic frames
+void avh_save(avh_state_t *copy)
+{
+    *copy = state;
+}
+
+
+// Put a saved controller state back
+void avh_restore(const avh_state_t *copy)
+{
+    state = *copy;
+    avh_seal();
+}
+
+
+// Returns 1 while the engine is stopped
+uint8_t avh_engine_stopped(void)
+{
+    return state.AvhControlStatus == ENGINE_STOP;
+}
+
+
+// Show the current status on the LEDs
+void avh_led(void)
+{
+    led_blink((state.VnxParam.AvhStatus << 1) + state.AvhControl);
+}
+
+
+// Process one received frame
+void avh_process(CAN_RxHeaderTypeDef *rx_msg_header, uint8_t *rx_msg_data)
+{
+    if(rx_msg_header->RTR != CAN_RTR_DATA || rx_msg_header->DLC != 8){
+        return;
+    }
+
+    switch (rx_msg_header->StdId){
+        case CAN_ID_ACCEL:
+            state.VnxParam.Accel = rx_msg_data[4] / 2.55;
+            state.PreviousCanId = rx_msg_header->StdId;
+            break;
+
+        case CAN_ID_SHIFT:
+            state.VnxParam.Gear = (rx_msg_data[3] & 0x07);
+            state.PreviousCanId = rx_msg_header->StdId;
+            break;
+
+        case CAN_ID_SPEED:
+            state.PrevSpeed = state.VnxParam.Speed;
+            state.PrevBrake = state.VnxParam.Brake;
+            state.VnxParam.Speed = (rx_msg_data[2] + ((rx_msg_data[3] & 0x1f) << 8)) * 0.015694 * 3.6;
+            state.VnxParam.Brake = rx_msg_data[5] / 0.8;
+            if(100 < state.VnxParam.Brake){
+                state.VnxParam.Brake = 100;
+            }
+            if(state.MaxBrake < state.VnxParam.Brake){
+                state.MaxBrake = state.VnxParam.Brake;
+            }
+            state.VnxParam.ParkBrake = ((rx_msg_data[7] & 0xf0) == 0x50);
+
+            // dprintf_("# DEBUG Brake:%d.%02d(%d.%02d)%% Speed:%d.%02d(%d.%02d)km/h\n", (int)state.VnxParam.Brake, (int)(state.VnxParam.Brake * 100) % 100, (int)state.PrevBrake, (int)(state.PrevBrake * 100) % 100, (int)state.VnxParam.Speed, (int)(state.VnxParam.Speed * 100) % 100, (int)state.PrevSpeed, (int)(state.PrevSpeed * 100) % 100);
+
+            if(state.PrevSpeed != 0.0 && state.VnxParam.Speed == 0.0 && state.VnxParam.EyeSight.Acc == ON){
+                if(state.OffByBrake == OFF){
+                    state.OffByBrake = ON;
+                    dprintf_("# DEBUG Brake:%d.%02d(%d.%02d)%% Speed:%d.%02d(%d.%02d)km/h\n", (int)state.VnxParam.Brake, (int)(state.VnxParam.Brake * 100) % 100, (int)state.PrevBrake, (int)(state.PrevBrake * 100) % 100, (int)state.VnxParam.Speed, (int)(state.VnxParam.Speed * 100) % 100, (int)state.PrevSpeed, (int)(state.PrevSpeed * 100) % 100);
+                    dprintf_("# DEBUG ACC:%d(0:OFF,1:ON) ByBrake:%d(0:OFF,1:ON)\n", state.VnxParam.EyeSight.Acc, state.OffByBrake);
+                }
+            }
+            
+            if(state.VnxParam.Brake == 0.0){
+                if(state.OffByBrake == ON){
+                    state.OffByBrake = OFF;
+                    dprintf_("# DEBUG Brake:%d.%02d(%d.%02d)%% Speed:%d.%02d(%d.%02d)km/h\n", (int)state.VnxParam.Brake, (int)(state.VnxParam.Brake * 100) % 100, (int)state.PrevBrake, (int)(state.PrevBrake * 100) % 100, (int)state.VnxParam.Speed, (int)(state.VnxParam.Speed * 100) % 100, (int)state.PrevSpeed, (int)(state.PrevSpeed * 100) % 100);
+                    dprintf_("# DEBUG ACC:%d(0:OFF,1:ON) ByBrake:%d(0:OFF,1:ON)\n", state.VnxParam.EyeSight.Acc, state.OffByBrake);
+                }
+                if(state.RepressBrake == ON){
+                    state.RepressBrake = OFF; // AVH HOLD Available
+                    // dprintf_("# DEBUG Brake:%d.%02d(%d.%02d)%% Speed:%d.%02d(%d.%02d)km/h\n", (int)state.VnxParam.Brake, (int)(state.VnxParam.Brake * 100) % 100, (int)state.PrevBrake, (int)(state.PrevBrake * 100) % 100, (int)state.VnxParam.Speed, (int)(state.VnxParam.Speed * 100) % 100, (int)state.PrevSpeed, (int)(state.PrevSpeed * 100) % 100);
+                    dprintf_("# DEBUG AVH:%d(0:OFF,1:ON,3:HOLD) ReBrake:%d(0:OFF,1:ON)\n", state.VnxParam.AvhStatus, state.RepressBrake);
+                }
+            }
+
+            switch (state.VnxParam.AvhStatus){
+                case AVH_HOLD:
+                    if(state.RepressBrake == OFF){
+                        if(state.PrevBrake == 0.0 && state.VnxParam.Brake != 0.0){
+                            state.RepressBrake = ON; // AVH HOLD shall be released by press brake again
+                            // dprintf_("# DEBUG Brake:%d.%02d(%d.%02d)%% Speed:%d.%02d(%d.%02d)km/h\n", (int)state.VnxParam.Brake, (int)(state.VnxParam.Brake * 100) % 100, (int)state.PrevBrake, (int)(state.PrevBrake * 100) % 100, (int)state.VnxParam.Speed, (int)(state.VnxParam.Speed * 100) % 100, (int)state.PrevSpeed, (int)(state.PrevSpeed * 100) % 100);
+                            dprintf_("# DEBUG AVH:%d(0:OFF,1:ON,3:HOLD) ReBrake:%d(0:OFF,1:ON)\n", state.VnxParam.AvhStatus, state.RepressBrake);
+                        }
+                    }
+                    if(state.ProgStatus == PROCESSING){
+                        if(state.AvhControl == AVH_ON){
+                            // If shift is 'P', AVH HOLD shall be released automatically
+                            if((state.VnxParam.Gear == SHIFT_N || (state.VnxParam.Gear == SHIFT_R && state.RepressBrake == OFF)) && BRAKE_LOW <= state.VnxParam.Brake){
+                                state.AvhControl = AVH_OFF;
+                                led_blink((state.VnxParam.AvhStatus << 1) + state.AvhControl);
+                                print_param(&state.VnxParam, state.AvhControl, state.PrevSpeed, state.PrevBrake, state.MaxBrake);
+                            }
+                        }
+                    }
+                    break;
+
+                case AVH_OFF:
+                    if(state.ProgStatus == PROCESSING){
+                        if(state.AvhControl == AVH_OFF){
+                            if(state.RepressBrake == OFF && state.VnxParam.Gear == SHIFT_D && state.VnxParam.ParkBrake == OFF && state.VnxParam.Speed == 0.0 && state.VnxParam.Accel == 0.0 && state.VnxParam.SeatBelt == CLOSE && state.VnxParam.Door == CLOSE && state.VnxParam.EyeSight.Hold == UNHOLD && state.OffByBrake == OFF && state.PrevSpeed == 0.0 && state.PrevBrake < BRAKE_HIGH && BRAKE_HIGH <= state.VnxParam.Brake){
+                                state.AvhControl = AVH_ON;
+                                led_blink((state.VnxParam.AvhStatus << 1) + state.AvhControl);
+                                print_param(&state.VnxParam, state.AvhControl, state.PrevSpeed, state.PrevBrake, state.MaxBrake);
+                            }
+                        }
+                    }
+                    break;
+                
+                default: // AVH_ON
+                    break;
+                    
+            }
+
+            state.PreviousCanId = rx_msg_header->StdId;
+            break;
+
+        case CAN_ID_EYESIGHT:
+            state.PrevEyeSight.Switch = state.VnxParam.EyeSight.Switch;
+            state.PrevEyeSight.Acc = state.VnxParam.EyeSight.Acc;
+            state.PrevEyeSight.Ready = state.VnxParam.EyeSight.Ready;
+            state.PrevEyeSight.Hold = state.VnxParam.EyeSight.Hold;
+            state.VnxParam.EyeSight.Switch = ((rx_msg_data[6] & 0x02) == 0x02);
+            state.VnxParam.EyeSight.Acc = ((rx_msg_data[4] & 0x10) == 0x10);
+            state.VnxParam.EyeSight.Ready = ((rx_msg_data[7] & 0x20) == 0x20);
+            state.VnxParam.EyeSight.Hold = ((rx_msg_data[7] & 0x10) == 0x10);
+
+            state.PreviousCanId = rx_msg_header->StdId;
+#ifdef DEBUG_MODE
+            candump_rx_frame(rx_msg_header, rx_msg_data);
+            // printf_("Switch:%d(%d) Acc:%d(%d) Ready:%d(%d) Hold:%d(%d)\n", state.VnxParam.EyeSight.Switch, state.PrevEyeSight.Switch, state.VnxParam.EyeSight.Acc, state.PrevEyeSight.Acc, state.VnxParam.EyeSight.Ready, state.PrevEyeSight.Ready, state.VnxParam.EyeSight.Hold, state.PrevEyeSight.Hold);
+#endif
+            if(state.VnxParam.EyeSight.Acc == OFF && state.PrevEyeSight.Ready == ON && state.VnxParam.EyeSight.Ready == OFF && state.PrevEyeSight.Hold == HOLD && state.VnxParam.EyeSight.Hold == UNHOLD && state.VnxParam.Speed == 0.0){
+                if(state.OffByBrake == OFF){
+                    state.OffByBrake = ON;
+                    dprintf_("Switch:%d(%d) Acc:%d(%d) Ready:%d(%d) Hold:%d(%d)\n", state.VnxParam.EyeSight.Switch, state.PrevEyeSight.Switch, state.VnxParam.EyeSight.Acc, state.PrevEyeSight.Acc, state.VnxParam.EyeSight.Ready, state.PrevEyeSight.Ready, state.VnxParam.EyeSight.Hold, state.PrevEyeSight.Hold);
+                    dprintf_("# DEBUG ByBrake:%d(0:OFF,1:ON)\n", state.OffByBrake);
+                }
+            }
+            
+            break;
+
+        case CAN_ID_AVH_STATUS:
+            state.PrevAvhStatus = state.VnxParam.AvhStatus;
+            state.VnxParam.AvhStatus = ((rx_msg_data[5] & 0x20) == 0x20) + (((rx_msg_data[5] & 0x22) == 0x22) << 1);
+
+            if(state.ProgStatus == PROCESSING){
+                if((state.PrevAvhStatus & 0b01) != (state.VnxParam.AvhStatus & 0b01)){ // AVH_OFF <=> AVH_ON/AVH_HOLD
+                    if(state.Retry != 0 && state.AvhControl == (state.VnxParam.AvhStatus & 0b01)){
+                        // Output Information message
+                        dprintf_("# INFO AVH:%d(0:OFF,1:ON,3:HOLD) succeeded. Retry:%d\n", state.VnxParam.AvhStatus, state.Retry);
+                        journal_log(EVT_AVH_SUCCEEDED, state.VnxParam.AvhStatus, state.Retry);
+                        state.Retry = 0;
+                    }
+                    led_blink((state.VnxParam.AvhStatus << 1) + state.AvhControl);
+                } else {
+                    if((state.PrevAvhStatus == AVH_HOLD) && (state.VnxParam.AvhStatus == AVH_ON)){ // AVH_HOLD => AVH_ON
+                        state.AvhControl = AVH_OFF;
+                        led_blink((state.VnxParam.AvhStatus << 1) + state.AvhControl);
+                        dprintf_("# INFO AVH HOLD released. ReBrake:%d ByBrake:%d\n", state.RepressBrake, state.OffByBrake);
+                        journal_log(EVT_AVH_HOLD_RELEASED, state.RepressBrake, state.OffByBrake);
+                    }
+                }
+            }
+
+            // state.PreviousCanId = rx_msg_header->StdId;
+            break;
+
+        case CAN_ID_BELT:
+            state.PrevSeatBelt = state.VnxParam.SeatBelt;
+            state.VnxParam.SeatBelt = ((rx_msg_data[6] & 0x01) == 0x01);
+            if(state.PrevSeatBelt == OPEN && state.VnxParam.SeatBelt == CLOSE && (state.ProgStatus == FAILED || state.ProgStatus == CANCELLED)){
+                dprintf_("# INFO AVH control restarted.\n");
+                journal_log(EVT_CONTROL_RESTARTED, state.VnxParam.AvhStatus, 0);
+                switch(state.VnxParam.AvhStatus){
+                    case AVH_ON:
+                        state.AvhControl = AVH_OFF;
+                        print_param(&state.VnxParam, state.AvhControl, state.PrevSpeed, state.PrevBrake, state.MaxBrake);
+                        break;
+                    
+                    default: // AVH_HOLD or AVH_OFF
+                        state.AvhControl = (state.VnxParam.AvhStatus & 0b01);
+                        break;
+                }
+                state.ProgStatus = PROCESSING;
+                led_blink((state.VnxParam.AvhStatus << 1) + state.AvhControl);
+            }
+            // state.PreviousCanId = rx_msg_header->StdId;
+            break;
+
+        case CAN_ID_DOOR:
+            state.VnxParam.Door = ((rx_msg_data[4] & 0x01) == 0x01);
+            // state.PreviousCanId = rx_msg_header->StdId;
+            break;
+
+        case CAN_ID_AVH_CONTROL:
+            if(state.PreviousCanId == CAN_ID_AVH_CONTROL){ // Engine is stopped
+                if(state.AvhControlStatus != ENGINE_STOP){
+                    state.AvhControlStatus = ENGINE_STOP;
+                    state.ProgStatus = PROCESSING;
+                    state.AvhControl = AVH_OFF;
+                    state.PrevAvhStatus = AVH_OFF;
+                    state.Retry = 0;
+                    state.RepressBrake = OFF;
+                    state.PrevSeatBelt = OPEN;
+                    state.PrevSpeed = 0;
+                    state.PrevBrake = 0;
+                    state.PrevEyeSight.Switch = OFF;
+                    state.PrevEyeSight.Acc = OFF;
+                    state.PrevEyeSight.Ready = OFF;
+                    state.PrevEyeSight.Hold = UNHOLD;
+                    state.OffByBrake = OFF;
+                    state.warm_restarts = 0;
+                    init_param(&state.VnxParam);
+                    led_blink((state.VnxParam.AvhStatus << 1) + state.AvhControl);
+                    dprintf_("# INFO ENGINE stop.\n");
+                    journal_log(EVT_ENGINE_STOP, 0, 0);
+                }
+            } else {
+                if((rx_msg_data[2] & 0x03) != 0x0){
+                    if(state.ProgStatus != CANCELLED){
+                        state.ProgStatus = CANCELLED;
+                        state.Retry = 0;
+                        state.Led = OFF;
+                        dprintf_("# INFO AVH control cancelled.\n");
+                        journal_log(EVT_CONTROL_CANCELLED, 0, 0);
+                    }
+                }
+                    
+                switch(state.ProgStatus){
+                    case PROCESSING:
+                        switch(state.AvhControlStatus){
+                            case READY:
+                                switch(state.VnxParam.AvhStatus){
+                                    case AVH_HOLD:
+                                        if(state.AvhControl == AVH_OFF){
+                                            if(state.VnxParam.Brake < BRAKE_LOW){
+                                                dprintf_("# INFO AVH OFF request cancelled. Retry:%d\n", state.Retry);
+                                                journal_log(EVT_AVH_OFF_CANCELLED, state.Retry, (uint8_t)state.VnxParam.Brake);
+                                                state.Retry = 0;
+                                                state.AvhControl = AVH_ON;
+                                                print_param(&state.VnxParam, state.AvhControl, state.PrevSpeed, state.PrevBrake, state.MaxBrake);
+                                                led_blink((state.VnxParam.AvhStatus << 1) + state.AvhControl);
+                                            }
+                                        }
+                                        break;
+                                    
+                                    case AVH_ON:
+                                        if(state.AvhControl == AVH_ON){
+                                            dprintf_("# ERROR AVH HOLD failed. ReBrake:%d=>1 ByBrake:%d\n", state.RepressBrake, state.OffByBrake);
+                                            journal_log(EVT_AVH_HOLD_FAILED, state.RepressBrake, state.OffByBrake);
+                                            state.RepressBrake = ON; // Maybe brake was pressed again during engine stop
+                                            // state.OffByBrake = ON;
+                                            state.AvhControl = AVH_OFF;
+                                            print_param(&state.VnxParam, state.AvhControl, state.PrevSpeed, state.PrevBrake, state.MaxBrake);
+                                            led_blink((state.VnxParam.AvhStatus << 1) + state.AvhControl);
+                                        }
+                                        break;
+                                    
+                                    default: // AVH_OFF
+                                        // Requested at standstill, but moving again before it went
+                                        // through: never introduce AVH while moving
+                                        if(state.AvhControl == AVH_ON && state.VnxParam.Speed != 0.0){
+                                            dprintf_("# INFO AVH ON request withdrawn. Retry:%d\n", state.Retry);
+                                            journal_log(EVT_AVH_ON_WITHDRAWN, state.Retry, state.VnxParam.Speed < 255 ? (uint8_t)state.VnxParam.Speed : 255);
+                                            state.Retry = 0;
+                                            state.AvhControl = AVH_OFF;
+                                            led_blink((state.VnxParam.AvhStatus << 1) + state.AvhControl);
+                                        }
+                                        break;
+
+                                }
+
+                                if((state.VnxParam.AvhStatus & 0b01) != state.AvhControl){ // Transmit message for Enable or disable auto vehicle hold
+                                    if(MAX_RETRY <= state.Retry){ // Previous enable or disable auto vehicle hold message failed
+                                        // Output Warning message
+                                        state.ProgStatus = FAILED;
+                                        journal_log(EVT_AVH_FAILED, state.AvhControl, state.Retry);
+                                        state.Retry = 0;
+                                        state.Led = OFF;
+                                        dprintf_("# ERROR AVH:%d(0:OFF,1:ON) failed. Retry:%d\n", state.AvhControl, state.Retry);
+                                    } else if(error_can_passive() && HAL_GetTick() - PassiveTxTick < PASSIVE_TX_INTERVAL){
+                                        // Error passive or bus-off: at most one attempt per PASSIVE_TX_INTERVAL,
+                                        // so control frames don't add to the bus trouble
+                                    } else {
+                                        PassiveTxTick = HAL_GetTick();
+                                        state.Retry++;
+                                        for(int i = 0;i < 2;i++){
+                                            supervisor_delay(RETRY_DELAY);
+                                            transmit_can_frame(rx_msg_data, state.AvhControl); // Transmit can frame for introduce or remove AVH
+                                        }
+                                        // Discard message(s) that received during supervisor_delay()
+                                        while(is_can_msg_pending(CAN_RX_FIFO0)){
+                                            can_rx(rx_msg_header, rx_msg_data);
+#ifdef DEBUG_MODE
+                                            slcan_frame(rx_msg_header, rx_msg_data);
+#endif
+#ifdef USB_GSUSB
+                                            gs_usb_frame(rx_msg_header, rx_msg_data);
+#endif
+                                        }
+                                        // rx_msg_header->StdId = CAN_ID_SHIFT
+                                    }
+                                }
+                                break;
+                            
+                            case ENGINE_STOP:
+                                dprintf_("# INFO ENGINE start.\n");
+                                journal_log(EVT_ENGINE_START, 0, 0);
+                                supervisor_start();
+                            case PAUSE:
+                                state.AvhControlStatus = READY;
+                                break;
+                        }
+                        break;
+
+                    case CANCELLED:
+                    case FAILED:
+                        if((rx_msg_data[2] & 0x03) == 0x0){
+                            if(state.Led){
+                                led_blink((!state.VnxParam.AvhStatus << 1) + (!state.AvhControl & 0x01));
+                                state.Led = OFF;
+                            } else {
+                                led_blink((state.VnxParam.AvhStatus << 1) + state.AvhControl);
+                                state.Led = ON;
+                            }
+                        }
+                        break;
+                }
+            }
+                
+            state.PreviousCanId = rx_msg_header->StdId;
+            break;
+
+        default: // Unexpected can id
+            // Output Warning message
+            // dprintf_("# Warning: Unexpected can id (0x%03x).\n", rx_msg_header->StdId);
+            break;
+    }
+
+    avh_seal();
+}
@@ -1,49 +1,416 @@
 //
 // avhcontroller: Parse an incoming command from the USB CDC port and change function
 //
+// Commands are parsed incrementally, straight out of the USB receive buffer:
+// a command character, optional arguments separated by spaces or commas and a
+// CR and/or LF terminator. Arguments are decimal ("-63"), or hex when prefixed
+// with "0x" or "$" ("0x3C", "$3C"). A packet may hold any number of commands,
+// and a command may be split across packets.
+//
 
 #include "stm32f0xx_hal.h"
 #include <string.h>
 #include "can.h"
 #include "error.h"
 #include "printf.h"
+#include "system.h"
 #include "usbd_cdc_if.h"
+#include "journal.h"
+#include "calib.h"
+#include "slcan.h"
+#include "boot.h"
+#include "supervisor.h"
+#include "fault.h"
+#include "loopback.h"
+#include "avh.h"
+#include "avhcontroller.h"
 #include "subaru_levorg_vnx.h"
 
-// Parse an incoming command from the USB CDC port
-int8_t avhcontroller_parse_str(uint8_t *buf, uint8_t len)
+
+// Parser states
+enum parser_state {
+    PARSE_IDLE,    // Waiting for a command character
+    PARSE_ARGS,    // Collecting arguments
+    PARSE_DISCARD  // Error: skip until end of line
+};
+
+// Command handler and table entry
+typedef int8_t (*avhcontroller_cmd_fn)(uint8_t argc, int32_t *argv);
+
+typedef struct _avhcontroller_cmd_
+{
+    char cmd;
+    uint8_t min_args;
+    uint8_t max_args;
+    avhcontroller_cmd_fn fn;
+} avhcontroller_cmd_t;
+
+
+// Private function prototypes
+static int8_t cmd_version(uint8_t argc, int32_t *argv);
+static int8_t cmd_journal(uint8_t argc, int32_t *argv);
+static int8_t cmd_calib(uint8_t argc, int32_t *argv);
+static int8_t cmd_calib_reset(uint8_t argc, int32_t *argv);
+static int8_t cmd_usb_bench(uint8_t argc, int32_t *argv);
+static int8_t cmd_sniffer(uint8_t argc, int32_t *argv);
+static int8_t cmd_printf_bench(uint8_t argc, int32_t *argv);
+static int8_t cmd_timing(uint8_t argc, int32_t *argv);
+static int8_t cmd_supervisor(uint8_t argc, int32_t *argv);
+static int8_t cmd_fault(uint8_t argc, int32_t *argv);
+static int8_t cmd_ram(uint8_t argc, int32_t *argv);
+static int8_t cmd_can_errors(uint8_t argc, int32_t *argv);
+static int8_t cmd_loopback(uint8_t argc, int32_t *argv);
+
+
+// Command table (upper case, lookup is case-insensitive)
+static const avhcontroller_cmd_t commands[] = {
+    { 'V', 0, 0, cmd_version },
+    { 'J', 0, 0, cmd_journal },
+    { 'C', 0, 2, cmd_calib },
+    { 'R', 0, 0, cmd_calib_reset },
+    { 'B', 1, 1, cmd_usb_bench },
+    { 'M', 0, 1, cmd_sniffer },
+    { 'P', 0, 1, cmd_printf_bench },
+    { 'T', 0, 0, cmd_timing },
+    { 'W', 0, 0, cmd_supervisor },
+    { 'F', 0, 0, cmd_fault },
+    { 'S', 0, 0, cmd_ram },
+    { 'E', 0, 0, cmd_can_errors },
+    { 'L', 0, 1, cmd_loopback },
+};
+
+// Private variables
+static struct {
+    uint8_t state;
+    const avhcontroller_cmd_t *cmd;
+    uint8_t argc;
+    int32_t argv[AVHCONTROLLER_MAX_ARGS];
+    uint8_t started;  // A token is being collected
+    uint8_t digits;   // Digits seen in the current token
+    uint8_t base;     // Base of the current token (10 or 16)
+    uint8_t negative; // Current token has a leading '-'
+    uint8_t prefix;   // Current token is "0" and may become "0x"
+} parser = { PARSE_IDLE };
+
+
+// Report firmware version and remote
+static int8_t cmd_version(uint8_t argc, int32_t *argv)
+{
+    printf_(GIT_VERSION " " GIT_REMOTE "\n");
+    return 0;
+}
+
+
+// Stream the event journal, oldest record first
+static int8_t cmd_journal(uint8_t argc, int32_t *argv)
+{
+    journal_dump();
+    return 0;
+}
+
+
+// Read calibration (C) or write one parameter (C index value)
+static int8_t cmd_calib(uint8_t argc, int32_t *argv)
+{
+    int8_t result = 0;
+
+    if(argc == 1)
+        return -1;
+
+    if(argc == 2)
+    {
+        // calib_set() takes narrower types: range check here, it checks the limits
+        if(argv[0] < 0 || CALIB_MAX <= argv[0] || argv[1] < INT16_MIN || INT16_MAX < argv[1])
+            return -1;
+        result = calib_set(argv[0], argv[1]);
+    }
+
+    calib_print();
+    return result;
+}
+
+
+// Restore the default calibration
+static int8_t cmd_calib_reset(uint8_t argc, int32_t *argv)
+{
+    int8_t result = calib_restore_defaults();
+    calib_print();
+    return result;
+}
+
+
+// USB throughput benchmark: stream argv[0] KiB of filler, then report bytes and ms.
+// Only while the engine is stopped: the main loop is blocked for the whole run.
+static int8_t cmd_usb_bench(uint8_t argc, int32_t *argv)
+{
+    uint8_t packet[TX_BUF_SIZE];
+    uint32_t sent = 0;
+    uint32_t busy = 0;
+
+    if(argv[0] <= 0 || 4096 < argv[0] || !avh_engine_stopped())
+        return -1;
+
+    memset(packet, 'U', sizeof(packet));
+
+    uint32_t start = HAL_GetTick();
+    while(sent < (uint32_t)argv[0] * 1024 && HAL_GetTick() - start < AVHCONTROLLER_BENCH_TIMEOUT)
+    {
+        if(CDC_Transmit_FS(packet, sizeof(packet)) == USBD_OK)
+            sent += sizeof(packet);
+        else if(++busy > 100) // Host stopped reading
+            break;
+    }
+    uint32_t elapsed = HAL_GetTick() - start;
+
+    printf_("\nB %u %u %u\n", sent, elapsed, busy);
+    return 0;
+}
+
+
+// Sniffer mode: M reports counters, M 1 / M 0 enables / disables SLCAN streaming
+static int8_t cmd_sniffer(uint8_t argc, int32_t *argv)
+{
+    if(argc == 1)
+        slcan_set_enabled(argv[0]);
+    else
+        slcan_report();
+    return 0;
+}
+
+
+// printf_ cost: format a typical debug line argv[0] (default 100) times, report cycles per line
+static int8_t cmd_printf_bench(uint8_t argc, int32_t *argv)
+{
+    int32_t count = (argc == 1) ? argv[0] : 100;
+
+    if(count <= 0 || 10000 < count)
+        return -1;
+
+    uint32_t start = system_cycles();
+    for(int32_t i = 0; i < count; i++)
+    {
+        // NULL buffer: format only, no output
+        snprintf_(NULL, 0, "# DEBUG Brake:%d.%02d(%d.%02d)%% Speed:%d.%02d(%d.%02d)km/h\n", 62, 50, 0, 0, 0, 0, 12, 34);
+    }
+    uint32_t cycles = system_cycles() - start;
+
+    printf_("P %d %u\n", count, cycles / count);
+    return 0;
+}
+
+
+// Report timing measurements: ISR duration in core cycles (48 per us), RX latency in us
+static int8_t cmd_timing(uint8_t argc, int32_t *argv)
+{
+    uint32_t isr_last, isr_max, lat_last, lat_max, wake_count, wake_latency;
+
+    can_isr_cycles(&isr_last, &isr_max);
+    can_rx_latency(&lat_last, &lat_max);
+    can_wake_stats(&wake_count, &wake_latency);
+    printf_("T isr:%u/%u lat:%u/%u idle:%d%% wake:%u/%u\n", isr_last, isr_max, lat_last, lat_max, system_idle_percent(), wake_count, wake_latency);
+    boot_report();
+    return 0;
+}
+
+
+// Report the main loop supervisor: watchdog state, worst iteration, deadline misses, histogram
+static int8_t cmd_supervisor(uint8_t argc, int32_t *argv)
 {
+    supervisor_report();
+    return 0;
+}
+
+
+// Report the crash record found at boot (symbolize with tools/crash_symbolize.py)
+static int8_t cmd_fault(uint8_t argc, int32_t *argv)
+{
+    fault_report();
+    return 0;
+}
 
-    // Convert from ASCII (2nd character to end)
-    for (uint8_t i = 1; i < len; i++)
+
+// Report RAM use: stack high-water mark and the static sections (see make ram-report)
+static int8_t cmd_ram(uint8_t argc, int32_t *argv)
+{
+    system_ram_report();
+    return 0;
+}
+
+
+// Report the bxCAN error counters, state transitions and error codes
+static int8_t cmd_can_errors(uint8_t argc, int32_t *argv)
+{
+    error_can_report();
+    return 0;
+}
+
+
+// Loopback benchmark: run argv[0] (default 1000) scripted frames through the RX pipeline
+static int8_t cmd_loopback(uint8_t argc, int32_t *argv)
+{
+    int32_t count = (argc == 1) ? argv[0] : 1000;
+
+    if(count <= 0 || 10000 < count)
+        return -1;
+
+    return loopback_bench(count);
+}
+
+
+// Look up a command character in the command table
+static const avhcontroller_cmd_t* avhcontroller_lookup(uint8_t c)
+{
+    if(c >= 'a' && c <= 'z')
+        c = c - 'a' + 'A';
+
+    for(uint8_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
     {
-        // Lowercase letters
-        if(buf[i] >= 'a')
-            buf[i] = buf[i] - 'a' + 10;
-        // Uppercase letters
-        else if(buf[i] >= 'A')
-            buf[i] = buf[i] - 'A' + 10;
-        // Numbers
-        else
-            buf[i] = buf[i] - '0';
+        if(commands[i].cmd == c)
+            return &commands[i];
     }
+    return NULL;
+}
+
+
+// Start a new argument token
+static void avhcontroller_token_reset(void)
+{
+    parser.started = 0;
+    parser.digits = 0;
+    parser.base = 10;
+    parser.negative = 0;
+    parser.prefix = 0;
+}
 
-    // Process command
-    switch(buf[0])
+
+// Finish the current argument token. Returns -1 if it is malformed.
+static int8_t avhcontroller_token_end(void)
+{
+    if(!parser.started)
+        return 0;
+
+    // Dangling "-", "0x" or "$"
+    if(parser.digits == 0)
+        return -1;
+
+    if(parser.negative)
+        parser.argv[parser.argc] = -parser.argv[parser.argc];
+
+    parser.argc++;
+    avhcontroller_token_reset();
+    return 0;
+}
+
+
+// Feed one argument character. Returns -1 on a syntax error.
+static int8_t avhcontroller_token_char(uint8_t c)
+{
+    uint8_t nibble;
+
+    if(c == ' ' || c == ',' || c == '\t')
+        return avhcontroller_token_end();
+
+    if(!parser.started)
+    {
+        if(parser.argc >= AVHCONTROLLER_MAX_ARGS)
+            return -1;
+
+        parser.argv[parser.argc] = 0;
+        parser.started = 1;
+
+        if(c == '-')
+        {
+            parser.negative = 1;
+            return 0;
+        }
+    }
+
+    if(c == '$' && parser.digits == 0 && parser.base == 10)
     {
-		case 'v':
-		case 'V':
-		{
-			// Report firmware version and remote
-			printf_(GIT_VERSION " " GIT_REMOTE "\n");
-			break;
-		}
+        parser.base = 16;
+        return 0;
+    }
 
-    		default:
-    		// Error, unknown command
-    		return -1;
+    if((c == 'x' || c == 'X') && parser.prefix)
+    {
+        parser.base = 16;
+        parser.digits = 0;
+        parser.prefix = 0;
+        return 0;
     }
 
+    if(c >= '0' && c <= '9')
+        nibble = c - '0';
+    else if(parser.base == 16 && c >= 'a' && c <= 'f')
+        nibble = c - 'a' + 10;
+    else if(parser.base == 16 && c >= 'A' && c <= 'F')
+        nibble = c - 'A' + 10;
+    else
+        return -1;
+
+    // Too large for argv: the magnitude is accumulated, the sign applied at the end
+    if(parser.base == 16 && parser.argv[parser.argc] > (INT32_MAX >> 4))
+        return -1;
+    if(parser.base == 10 && parser.argv[parser.argc] > (INT32_MAX - nibble) / 10)
+        return -1;
+
+    parser.prefix = (parser.digits == 0 && parser.base == 10 && nibble == 0);
+    if(parser.base == 16)
+        parser.argv[parser.argc] = (parser.argv[parser.argc] << 4) | nibble;
+    else
+        parser.argv[parser.argc] = parser.argv[parser.argc] * 10 + nibble;
+    parser.digits++;
     return 0;
 }
 
+
+// Parse a chunk of incoming characters from the USB CDC port
+int8_t avhcontroller_parse(const uint8_t *buf, uint32_t len)
+{
+    int8_t result = 0;
+
+    for(uint32_t i = 0; i < len; i++)
+    {
+        uint8_t c = buf[i];
+
+        // End of line: run the command
+        if(c == '\r' || c == '\n')
+        {
+            if(parser.state == PARSE_ARGS)
+            {
+                if(avhcontroller_token_end() == 0 &&
+                   parser.cmd->min_args <= parser.argc && parser.argc <= parser.cmd->max_args)
+                    result = parser.cmd->fn(parser.argc, parser.argv);
+                else
+                    result = -1;
+            }
+            else if(parser.state == PARSE_DISCARD)
+            {
+                result = -1;
+            }
+            parser.state = PARSE_IDLE;
+            continue;
+        }
+
+        switch(parser.state)
+        {
+            case PARSE_IDLE:
+                parser.cmd = avhcontroller_lookup(c);
+                parser.argc = 0;
+                avhcontroller_token_reset();
+                // Error, unknown command
+                parser.state = parser.cmd ? PARSE_ARGS : PARSE_DISCARD;
+                break;
+
+            case PARSE_ARGS:
+                if(avhcontroller_token_char(c) != 0)
+                    parser.state = PARSE_DISCARD;
+                break;
+
+            default: // PARSE_DISCARD
+                break;
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,74 @@
+//
+// boot: power-on profile
+//
+// main() calls boot_mark() at each step of the init sequence. Marks are
+// stamped with system_cycles(), so they are relative to the point where the
+// 48 MHz SysTick was started; the time from reset to there is only visible on
+// the BOOT_MARK pin, which toggles at every mark in BOOT_PROFILE builds.
+// The log is printed once a USB host is attached.
+//
+
+#include "stm32f0xx_hal.h"
+#include "boot.h"
+#include "system.h"
+#include "printf.h"
+
+
+// Private variables
+static uint32_t mark_cycles[BOOT_MARK_MAX];
+static uint8_t reached = 0;
+
+static const char* const mark_name[BOOT_MARK_MAX] = {
+    "reset",
+    "clock",
+    "can",
+    "store",
+    "usb",
+    "frame",
+};
+
+
+// Record a checkpoint (only the first pass counts)
+void boot_mark(enum boot_mark mark)
+{
+    if(mark >= BOOT_MARK_MAX || boot_reached(mark))
+        return;
+
+#ifdef BOOT_PROFILE
+    if(mark == BOOT_RESET){
+        GPIO_InitTypeDef GPIO_InitStruct;
+
+        __HAL_RCC_GPIOB_CLK_ENABLE();
+        GPIO_InitStruct.Pin = BOOT_MARK_Pin;
+        GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+        GPIO_InitStruct.Pull = GPIO_NOPULL;
+        GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
+        GPIO_InitStruct.Alternate = 0;
+        HAL_GPIO_Init(BOOT_MARK_Port, &GPIO_InitStruct);
+    }
+    HAL_GPIO_TogglePin(BOOT_MARK_Port, BOOT_MARK_Pin);
+#endif
+
+    mark_cycles[mark] = (mark == BOOT_RESET) ? 0 : system_cycles();
+    reached |= (1 << mark);
+}
+
+
+// Returns 1 if the checkpoint has been passed
+uint8_t boot_reached(enum boot_mark mark)
+{
+    return (reached >> mark) & 1;
+}
+
+
+// Print the checkpoints reached so far in us after the clock came up
+void boot_report(void)
+{
+    printf_("BOOT");
+    for(uint8_t i = BOOT_CLOCK; i < BOOT_MARK_MAX; i++){
+        if(boot_reached(i)){
+            printf_(" %s:%u", mark_name[i], (mark_cycles[i] - mark_cycles[BOOT_CLOCK]) / 48);
+        }
+    }
+    printf_("\n");
+}
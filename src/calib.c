@@ -0,0 +1,186 @@
+//
+// calib: runtime-tunable calibration store (EEPROM emulation in flash)
+//
+// Two flash pages hold a log of calibration records. Every write appends a
+// complete, CRC-protected copy of all parameters with an incremented sequence
+// number. When the active page is full, the other page is erased and the
+// record goes there. At boot the valid record with the highest sequence
+// number is loaded into the RAM struct calib; defaults are used otherwise.
+//
+
+#include "stm32f0xx_hal.h"
+#include <stddef.h>
+#include <string.h>
+#include "calib.h"
+#include "can.h"
+#include "system.h"
+#include "printf.h"
+#include "subaru_levorg_vnx.h"
+
+
+// Calibration region (defined in STM32F042C6_FLASH.ld)
+extern uint32_t _scalib;
+extern uint32_t _ecalib;
+
+#define CALIB_START ((uint32_t)&_scalib)
+#define CALIB_PAGES 2
+#define CALIB_PAGE_SLOTS (FLASH_PAGE_SIZE / sizeof(calib_record_t))
+
+
+// Public variables
+calib_t calib;
+
+// Private variables
+static calib_record_t current;
+static uint32_t current_slot = 0;
+static uint8_t stored = 0;
+
+static const int16_t calib_default[CALIB_MAX] = {
+    BRAKE_HIGH_DEFAULT,
+    BRAKE_LOW_DEFAULT,
+    MAX_RETRY_DEFAULT,
+    RETRY_DELAY_DEFAULT,
+    SUM_CHECK_ADDER_DEFAULT,
+    BITRATE_DEFAULT,
+};
+
+static const int16_t calib_min[CALIB_MAX] = {   0,   0,  1,    0, -128, -1 };
+static const int16_t calib_max[CALIB_MAX] = { 100, 100, 15, 1000,  127, CAN_BITRATE_1000K };
+
+
+// Return pointer to a record slot in flash
+static const calib_record_t* calib_slot(uint32_t slot)
+{
+    return (const calib_record_t*)(CALIB_START + (slot / CALIB_PAGE_SLOTS) * FLASH_PAGE_SIZE +
+                                   (slot % CALIB_PAGE_SLOTS) * sizeof(calib_record_t));
+}
+
+
+// Check version and CRC of a record
+static uint8_t calib_valid(const calib_record_t* rec)
+{
+    return rec->version == CALIB_VERSION &&
+           rec->crc == system_crc32(rec, offsetof(calib_record_t, crc));
+}
+
+
+// Convert the stored values into the RAM working copy
+static void calib_apply(void)
+{
+    calib.brake_high = current.value[CALIB_BRAKE_HIGH];
+    calib.brake_low = current.value[CALIB_BRAKE_LOW];
+    calib.max_retry = current.value[CALIB_MAX_RETRY];
+    calib.retry_delay = current.value[CALIB_RETRY_DELAY];
+    calib.sum_check_adder = current.value[CALIB_SUM_CHECK_ADDER];
+    calib.bitrate = current.value[CALIB_BITRATE];
+}
+
+
+// Load the newest valid record (or the defaults) into RAM
+void calib_init(void)
+{
+    stored = 0;
+    for(uint32_t slot = 0; slot < CALIB_PAGES * CALIB_PAGE_SLOTS; slot++){
+        const calib_record_t* rec = calib_slot(slot);
+        if(calib_valid(rec) && (!stored || (int16_t)(rec->seq - current.seq) > 0)){
+            current = *rec;
+            current_slot = slot;
+            stored = 1;
+        }
+    }
+
+    if(!stored){
+        memset(&current, 0, sizeof(current));
+        current.version = CALIB_VERSION;
+        memcpy(current.value, calib_default, sizeof(current.value));
+    }
+    calib_apply();
+}
+
+
+// Append the current record to flash, swapping pages when the active one is full
+static int8_t calib_store(void)
+{
+    uint32_t slot = stored ? current_slot + 1 : 0;
+
+    // Skip slots that are not erased
+    while(slot % CALIB_PAGE_SLOTS != 0 && calib_slot(slot)->version != 0xFFFF){
+        slot++;
+    }
+    slot %= CALIB_PAGES * CALIB_PAGE_SLOTS;
+
+    current.version = CALIB_VERSION;
+    current.seq++;
+    current.reserved = 0xFFFF;
+    current.crc = system_crc32(&current, offsetof(calib_record_t, crc));
+
+    HAL_FLASH_Unlock();
+
+    if(slot % CALIB_PAGE_SLOTS == 0){
+        FLASH_EraseInitTypeDef erase;
+        uint32_t page_error = 0;
+
+        erase.TypeErase = FLASH_TYPEERASE_PAGES;
+        erase.PageAddress = (uint32_t)calib_slot(slot);
+        erase.NbPages = 1;
+        HAL_FLASHEx_Erase(&erase, &page_error);
+    }
+
+    const uint32_t* src = (const uint32_t*)&current;
+    uint32_t addr = (uint32_t)calib_slot(slot);
+    HAL_StatusTypeDef status = HAL_OK;
+    for(uint8_t i = 0; i < sizeof(calib_record_t) / 4 && status == HAL_OK; i++){
+        status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr + i * 4, src[i]);
+    }
+
+    HAL_FLASH_Lock();
+
+    if(status != HAL_OK || !calib_valid(calib_slot(slot))){
+        return -1;
+    }
+    current_slot = slot;
+    stored = 1;
+    return 0;
+}
+
+
+// Get a calibration parameter
+int16_t calib_get(uint8_t param)
+{
+    if(param >= CALIB_MAX)
+        return 0;
+
+    return current.value[param];
+}
+
+
+// Set a calibration parameter and persist it
+int8_t calib_set(uint8_t param, int16_t value)
+{
+    if(param >= CALIB_MAX || value < calib_min[param] || calib_max[param] < value)
+        return -1;
+
+    current.value[param] = value;
+    calib_apply();
+    return calib_store();
+}
+
+
+// Restore and persist the compile-time defaults
+int8_t calib_restore_defaults(void)
+{
+    memcpy(current.value, calib_default, sizeof(current.value));
+    calib_apply();
+    return calib_store();
+}
+
+
+// Print all parameters to the USB CDC port
+void calib_print(void)
+{
+    printf_("C v%d seq:%d%s", current.version, current.seq, stored ? "" : " (default)");
+    for(uint8_t i = 0; i < CALIB_MAX; i++){
+        printf_(" %d:%d", i, current.value[i]);
+    }
+    printf_("\n");
+}
@@ -6,16 +6,71 @@
 #include "usbd_cdc_if.h"
 #include "can.h"
 #include "error.h"
+#include "system.h"
 #include "subaru_levorg_vnx.h"
 
 
+// Load the compile-time bit timing of a bitrate
+#define CAN_BT_APPLY(br) do { \
+        prescaler = CAN_BT_BRP(br); \
+        time_seg1 = CAN_BT_TSEG1(br); \
+        time_seg2 = CAN_BT_TSEG2(br); \
+        sync_jump = CAN_BT_SJW(br); \
+    } while (0)
+
+// Every supported bitrate must have an exact timing within the bxCAN limits
+#define CAN_BT_CHECK(br) _Static_assert(CAN_CLOCK_HZ % ((br) * CAN_BT_TQ(br)) == 0 && \
+    CAN_BT_BRP(br) <= CAN_BRP_MAX && 1 <= CAN_BT_TSEG1(br) && CAN_BT_TSEG1(br) <= CAN_TSEG1_MAX && \
+    1 <= CAN_BT_TSEG2(br) && CAN_BT_TSEG2(br) <= CAN_TSEG2_MAX, "no bit timing for " #br " bit/s")
+
+CAN_BT_CHECK(10000);
+CAN_BT_CHECK(20000);
+CAN_BT_CHECK(50000);
+CAN_BT_CHECK(100000);
+CAN_BT_CHECK(125000);
+CAN_BT_CHECK(250000);
+CAN_BT_CHECK(500000);
+CAN_BT_CHECK(750000);
+CAN_BT_CHECK(1000000);
+
+
 // Private variables
 static CAN_HandleTypeDef can_handle;
 static CAN_FilterTypeDef filter;
 static uint32_t prescaler;
+static uint8_t time_seg1;
+static uint8_t time_seg2;
+static uint8_t sync_jump;
 static can_bus_state_t bus_state = OFF_BUS;
 static uint8_t can_autoretransmit = ENABLE;
+static uint32_t can_mode = CAN_MODE_NORMAL;
 static can_txbuf_t txqueue = {0};
+static can_rxring_t rxring = {0};
+static uint8_t filter_accept_all = 0;
+static uint32_t isr_cycles_last = 0;
+static uint32_t isr_cycles_max = 0;
+static uint32_t rx_latency_last = 0;
+static uint32_t rx_latency_max = 0;
+static uint32_t wake_timestamp = 0;
+static uint8_t wake_pending = 0;
+static uint32_t wake_latency = 0;
+static uint32_t wake_count = 0;
+
+
+// Load the acceptance filter: AVH frames only, or everything (sniffer mode)
+static void can_apply_filter(void)
+{
+    CAN_FilterTypeDef f = filter;
+
+    if (filter_accept_all)
+    {
+        f.FilterIdHigh = 0;
+        f.FilterIdLow = 0;
+        f.FilterMaskIdHigh = 0;
+        f.FilterMaskIdLow = 0;
+    }
+    HAL_CAN_ConfigFilter(&can_handle, &f);
+}
 
 
 // Initialize CAN peripheral settings, but don't actually start the peripheral
@@ -65,6 +120,13 @@ void can_init(void)
     can_handle.Instance = CAN;
     bus_state = OFF_BUS;
 
+    // Free-running 1 MHz timer (32-bit TIM2) for frame timestamps
+    __HAL_RCC_TIM2_CLK_ENABLE();
+    TIM2->PSC = (HAL_RCC_GetPCLK1Freq() / 1000000) - 1;
+    TIM2->ARR = 0xFFFFFFFF;
+    TIM2->EGR = TIM_EGR_UG;
+    TIM2->CR1 = TIM_CR1_CEN;
+
     HAL_NVIC_SetPriority(CEC_CAN_IRQn, 1, 0);
     HAL_NVIC_EnableIRQ(CEC_CAN_IRQn);
 
@@ -77,11 +139,11 @@ void can_enable(void)
     if (bus_state == OFF_BUS)
     {
     	can_handle.Init.Prescaler = prescaler;
-    	can_handle.Init.Mode = CAN_MODE_NORMAL;
+    	can_handle.Init.Mode = can_mode;
 
-    	can_handle.Init.SyncJumpWidth = CAN_SJW_1TQ;
-    	can_handle.Init.TimeSeg1 = CAN_BS1_4TQ;
-    	can_handle.Init.TimeSeg2 = CAN_BS2_3TQ;
+    	can_handle.Init.SyncJumpWidth = (uint32_t)(sync_jump - 1) << CAN_BTR_SJW_Pos;
+    	can_handle.Init.TimeSeg1 = (uint32_t)(time_seg1 - 1) << CAN_BTR_TS1_Pos;
+    	can_handle.Init.TimeSeg2 = (uint32_t)(time_seg2 - 1) << CAN_BTR_TS2_Pos;
     	can_handle.Init.TimeTriggeredMode = DISABLE;
     	can_handle.Init.AutoBusOff = ENABLE;
     	can_handle.Init.AutoWakeUp = DISABLE;
@@ -90,9 +152,11 @@ void can_enable(void)
     	can_handle.Init.TransmitFifoPriority = ENABLE;
         HAL_CAN_Init(&can_handle);
 
-        HAL_CAN_ConfigFilter(&can_handle, &filter);
+        can_apply_filter();
 
         HAL_CAN_Start(&can_handle);
+        HAL_CAN_ActivateNotification(&can_handle, CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_ERROR_WARNING |
+                                     CAN_IT_ERROR_PASSIVE | CAN_IT_BUSOFF | CAN_IT_LAST_ERROR_CODE | CAN_IT_ERROR);
         bus_state = ON_BUS;
 
     }
@@ -124,41 +188,62 @@ void can_set_bitrate(enum can_bitrate bitrate)
     switch (bitrate)
     {
         case CAN_BITRATE_10K:
-        	prescaler = 600;
+            CAN_BT_APPLY(10000);
             break;
         case CAN_BITRATE_20K:
-        	prescaler = 300;
+            CAN_BT_APPLY(20000);
             break;
         case CAN_BITRATE_50K:
-        	prescaler = 120;
+            CAN_BT_APPLY(50000);
             break;
         case CAN_BITRATE_100K:
-            prescaler = 60;
+            CAN_BT_APPLY(100000);
             break;
         case CAN_BITRATE_125K:
-            prescaler = 48;
+            CAN_BT_APPLY(125000);
             break;
         case CAN_BITRATE_250K:
-            prescaler = 24;
+            CAN_BT_APPLY(250000);
             break;
         case CAN_BITRATE_500K:
-            prescaler = 12;
+            CAN_BT_APPLY(500000);
             break;
         case CAN_BITRATE_750K:
-            prescaler = 8;
+            CAN_BT_APPLY(750000);
             break;
         case CAN_BITRATE_1000K:
-            prescaler = 6;
+            CAN_BT_APPLY(1000000);
             break;
         case CAN_BITRATE_INVALID:
         default:
-            prescaler = 6;
+            CAN_BT_APPLY(1000000);
             break;
     }
 
 }
 
 
+// Set the bit timing directly (gs_usb host). Bit time = brp * (1 + tseg1 + tseg2) tq of CAN_CLOCK_HZ.
+int8_t can_set_bittiming(uint32_t brp, uint8_t tseg1, uint8_t tseg2, uint8_t sjw)
+{
+    if (bus_state == ON_BUS)
+    {
+        // cannot set bitrate while on bus
+        return -1;
+    }
+    if (brp < 1 || CAN_BRP_MAX < brp || tseg1 < 1 || CAN_TSEG1_MAX < tseg1 ||
+        tseg2 < 1 || CAN_TSEG2_MAX < tseg2 || sjw < 1 || CAN_SJW_MAX < sjw || tseg2 < sjw)
+    {
+        return -1;
+    }
+    prescaler = brp;
+    time_seg1 = tseg1;
+    time_seg2 = tseg2;
+    sync_jump = sjw;
+    return 0;
+}
+
+
 // Set CAN peripheral to silent mode
 void can_set_silent(uint8_t silent)
 {
@@ -169,9 +254,28 @@ void can_set_silent(uint8_t silent)
     }
     if (silent)
     {
-    	can_handle.Init.Mode = CAN_MODE_SILENT;
+    	can_mode = CAN_MODE_SILENT;
+    } else {
+    	can_mode = CAN_MODE_NORMAL;
+    }
+
+}
+
+
+// Set CAN peripheral to silent loopback mode: transmitted frames are received
+// back, nothing is driven onto the bus
+void can_set_loopback(uint8_t loopback)
+{
+    if (bus_state == ON_BUS)
+    {
+        // cannot set loopback mode while on bus
+        return;
+    }
+    if (loopback)
+    {
+    	can_mode = CAN_MODE_SILENT_LOOPBACK;
     } else {
-    	can_handle.Init.Mode = CAN_MODE_NORMAL;
+    	can_mode = CAN_MODE_NORMAL;
     }
 
 }
@@ -195,6 +299,150 @@ void can_set_autoretransmit(uint8_t autoretransmit)
 }
 
 
+// Accept all frames (sniffer mode) or only the AVH related ones
+void can_set_accept_all(uint8_t accept_all)
+{
+    filter_accept_all = accept_all;
+
+    // Filters may be changed on bus, the peripheral keeps running
+    if (bus_state == ON_BUS)
+    {
+        can_apply_filter();
+    }
+}
+
+
+// Find the bus bitrate: listen in silent mode (no ACK, no error frames) at each
+// candidate for up to CAN_AUTOBAUD_DWELL ms. A candidate locks as soon as it
+// has received CAN_AUTOBAUD_FRAMES frames without a protocol error; otherwise
+// the one with the best score (frames - errors) wins. Takes at most
+// CAN_AUTOBAUD_DWELL ms per candidate. Returns CAN_BITRATE_INVALID on a silent bus;
+// *locked tells whether the result locked or is only the best guess.
+enum can_bitrate can_autobaud(uint8_t *locked)
+{
+    static const uint8_t order[] = {
+        CAN_BITRATE_500K, CAN_BITRATE_250K, CAN_BITRATE_125K, CAN_BITRATE_1000K, CAN_BITRATE_750K,
+        CAN_BITRATE_100K, CAN_BITRATE_50K, CAN_BITRATE_20K, CAN_BITRATE_10K,
+    };
+    CAN_RxHeaderTypeDef rx_msg_header;
+    uint8_t rx_msg_data[8];
+    enum can_bitrate best = CAN_BITRATE_INVALID;
+    int32_t best_score = 0;
+
+    *locked = 0;
+    if (bus_state == ON_BUS)
+    {
+        return CAN_BITRATE_INVALID;
+    }
+
+    can_set_silent(1);
+    can_set_accept_all(1);
+
+    for (uint8_t i = 0; i < sizeof(order); i++)
+    {
+        uint32_t frames = 0;
+        uint32_t errors = 0;
+        uint32_t start = HAL_GetTick();
+
+        can_set_bitrate(order[i]);
+        can_enable();
+
+        // Errors at a wrong bitrate are expected: polled here, kept out of the error statistics
+        __HAL_CAN_DISABLE_IT(&can_handle, CAN_IT_ERROR_WARNING | CAN_IT_ERROR_PASSIVE | CAN_IT_BUSOFF |
+                             CAN_IT_LAST_ERROR_CODE | CAN_IT_ERROR);
+        CAN->ESR = CAN_ESR_LEC; // 0b111: no new error
+
+        while (HAL_GetTick() - start < CAN_AUTOBAUD_DWELL && frames < CAN_AUTOBAUD_FRAMES)
+        {
+            while (is_can_msg_pending(CAN_RX_FIFO0))
+            {
+                can_rx(&rx_msg_header, rx_msg_data);
+                frames++;
+            }
+            uint32_t lec = CAN->ESR & CAN_ESR_LEC;
+            if (lec != 0 && lec != CAN_ESR_LEC)
+            {
+                errors++;
+                CAN->ESR = CAN_ESR_LEC;
+            }
+        }
+        errors += (CAN->ESR & CAN_ESR_REC) >> CAN_ESR_REC_Pos;
+        can_disable();
+
+        if (frames >= CAN_AUTOBAUD_FRAMES && errors == 0)
+        {
+            best = order[i];
+            *locked = 1;
+            break;
+        }
+        if ((int32_t)(frames - errors) > best_score)
+        {
+            best = order[i];
+            best_score = frames - errors;
+        }
+    }
+
+    can_set_silent(0);
+    can_set_accept_all(0);
+    return best;
+}
+
+
+// Prepare for Stop mode: bxCAN to sleep, and the CAN RX pin (PB8) as a falling
+// edge EXTI line, so the start of frame bit of the next frame wakes the core up
+void can_sleep(void)
+{
+    GPIO_InitTypeDef GPIO_InitStruct;
+    uint32_t start = HAL_GetTick();
+
+    // Sleep is entered once a frame in progress has completed
+    HAL_CAN_RequestSleep(&can_handle);
+    while (!HAL_CAN_IsSleepActive(&can_handle) && HAL_GetTick() - start < 10);
+
+    GPIO_InitStruct.Pin = GPIO_PIN_8;
+    GPIO_InitStruct.Mode = GPIO_MODE_IT_FALLING;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
+    HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+    HAL_NVIC_SetPriority(EXTI4_15_IRQn, 1, 0);
+    HAL_NVIC_EnableIRQ(EXTI4_15_IRQn);
+}
+
+
+// Back from Stop mode: CAN RX pin to the peripheral again and bxCAN out of sleep.
+// The frame that woke us up is lost, the next one is received normally.
+void can_wakeup(void)
+{
+    GPIO_InitTypeDef GPIO_InitStruct;
+
+    HAL_NVIC_DisableIRQ(EXTI4_15_IRQn);
+    HAL_GPIO_DeInit(GPIOB, GPIO_PIN_8);
+
+    GPIO_InitStruct.Pin = GPIO_PIN_8;
+    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
+    GPIO_InitStruct.Alternate = GPIO_AF4_CAN;
+    HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+    // Waits for 11 recessive bits to resynchronize with the bus
+    HAL_CAN_WakeUp(&can_handle);
+
+    wake_timestamp = TIM2->CNT;
+    wake_pending = 1;
+    wake_count++;
+}
+
+
+// Number of wakeups from Stop mode, and the time from the last wakeup to its first frame in us
+void can_wake_stats(uint32_t *count, uint32_t *latency)
+{
+    *count = wake_count;
+    *latency = wake_latency;
+}
+
+
 // Send a message on the CAN bus
 uint32_t can_tx(CAN_TxHeaderTypeDef *tx_msg_header, uint8_t* tx_msg_data)
 {
@@ -241,23 +489,110 @@ void can_process(void)
 }
 
 
-// Receive message from the CAN bus RXFIFO
-uint32_t can_rx(CAN_RxHeaderTypeDef *rx_msg_header, uint8_t* rx_msg_data)
+// Receive message from the RX ring (filled from the CAN RX FIFO0 interrupt)
+RAMFUNC uint32_t can_rx(CAN_RxHeaderTypeDef *rx_msg_header, uint8_t* rx_msg_data)
 {
-    uint32_t status = HAL_CAN_GetRxMessage(&can_handle, CAN_RX_FIFO0, rx_msg_header, rx_msg_data);
+    if (rxring.tail == rxring.head)
+    {
+        return HAL_ERROR;
+    }
+
+    // Read the frame only after observing the new head
+    __DMB();
+    can_rxframe_t *frame = &rxring.frame[rxring.tail];
+
+    rx_msg_header->StdId = (frame->ide == CAN_ID_STD) ? frame->id : 0;
+    rx_msg_header->ExtId = (frame->ide == CAN_ID_EXT) ? frame->id : 0;
+    rx_msg_header->IDE = frame->ide;
+    rx_msg_header->RTR = frame->rtr;
+    rx_msg_header->DLC = frame->dlc;
+    rx_msg_header->Timestamp = frame->timestamp;
+
+    // First frame after a wakeup from Stop mode
+    if (wake_pending)
+    {
+        wake_latency = frame->timestamp - wake_timestamp;
+        wake_pending = 0;
+    }
+
+    // Time from the RX interrupt until the main loop picked the frame up
+    rx_latency_last = TIM2->CNT - frame->timestamp;
+    if (rx_latency_last > rx_latency_max)
+    {
+        rx_latency_max = rx_latency_last;
+    }
+    for (uint8_t i = 0; i < TXQUEUE_DATALEN; i++)
+    {
+        rx_msg_data[i] = frame->data[i];
+    }
+
+    // Release the slot to the ISR
+    __DMB();
+    rxring.tail = (rxring.tail + 1) % RXRING_LEN;
 
-    return status;
+    return HAL_OK;
 }
 
 
-// Check if a CAN message has been received and is waiting in the FIFO
-uint8_t is_can_msg_pending(uint8_t fifo)
+// Check if a CAN message has been received and is waiting in the RX ring
+RAMFUNC uint8_t is_can_msg_pending(uint8_t fifo)
 {
     if (bus_state == OFF_BUS)
     {
         return 0;
     }
-    return(HAL_CAN_GetRxFifoFillLevel(&can_handle, CAN_RX_FIFO0) > 0);
+    return(rxring.tail != rxring.head);
+}
+
+
+// Sample the bxCAN error state from the main loop (recovery from bus-off and
+// falling error counters raise no interrupt)
+void can_error_sample(void)
+{
+    if (bus_state == OFF_BUS)
+    {
+        return;
+    }
+    system_irq_disable();
+    error_can_state(CAN->ESR);
+    system_irq_enable();
+}
+
+
+// Number of frames waiting in the RX ring
+uint8_t can_rx_depth(void)
+{
+    return (rxring.head - rxring.tail + RXRING_LEN) % RXRING_LEN;
+}
+
+
+// Number of frames dropped because the RX ring was full
+uint32_t can_rx_dropped(void)
+{
+    return rxring.dropped;
+}
+
+
+// Duration of the last and of the longest RX interrupt, in core cycles
+void can_isr_cycles(uint32_t *last, uint32_t *max)
+{
+    *last = isr_cycles_last;
+    *max = isr_cycles_max;
+}
+
+
+// Time from the RX interrupt until can_rx() returned the frame (last and longest), in us
+void can_rx_latency(uint32_t *last, uint32_t *max)
+{
+    *last = rx_latency_last;
+    *max = rx_latency_max;
+}
+
+
+// Microseconds from the free-running frame timestamp timer
+uint32_t can_timestamp(void)
+{
+    return TIM2->CNT;
 }
 
 
@@ -268,9 +603,70 @@ CAN_HandleTypeDef* can_gethandle(void)
 }
 
 
-// Callback for FIFO0 full
-void HAL_CAN_RxFifo0FullCallback(CAN_HandleTypeDef *hcan)
+// FIFO0 message pending interrupt: move all frames from the hardware FIFO into the
+// RX ring. Runs from RAM and reads the mailbox registers directly, without
+// HAL_CAN_IRQHandler() and HAL_CAN_GetRxMessage().
+RAMFUNC void can_rx_isr(void)
 {
-	error_assert(ERR_CANRXFIFO_OVERFLOW);
-}
+	uint32_t start = SysTick->VAL;
+
+	while (CAN->RF0R & CAN_RF0R_FMP0)
+	{
+		uint8_t next = (rxring.head + 1) % RXRING_LEN;
+		can_rxframe_t *frame = &rxring.frame[rxring.head];
 
+		// Ring full: release the mailbox anyway to free the FIFO
+		if (next == rxring.tail)
+		{
+			CAN->RF0R = CAN_RF0R_RFOM0;
+			rxring.dropped++;
+			error_assert(ERR_FULLBUF_CANRX);
+			continue;
+		}
+
+		uint32_t rir = CAN->sFIFOMailBox[0].RIR;
+		uint32_t rdlr = CAN->sFIFOMailBox[0].RDLR;
+		uint32_t rdhr = CAN->sFIFOMailBox[0].RDHR;
+
+		frame->timestamp = TIM2->CNT;
+		frame->ide = rir & CAN_RI0R_IDE;
+		frame->rtr = rir & CAN_RI0R_RTR;
+		frame->id = (rir & CAN_RI0R_IDE) ? (rir >> CAN_RI0R_EXID_Pos) : (rir >> CAN_RI0R_STID_Pos);
+		frame->dlc = CAN->sFIFOMailBox[0].RDTR & CAN_RDT0R_DLC;
+		for (uint8_t i = 0; i < 4; i++)
+		{
+			frame->data[i] = rdlr >> (8 * i);
+			frame->data[i + 4] = rdhr >> (8 * i);
+		}
+		CAN->RF0R = CAN_RF0R_RFOM0;
+
+		// Publish the frame to the main loop
+		__DMB();
+		rxring.head = next;
+	}
+
+	if (CAN->RF0R & CAN_RF0R_FOVR0)
+	{
+		CAN->RF0R = CAN_RF0R_FOVR0;
+		error_assert(ERR_CANRXFIFO_OVERFLOW);
+	}
+
+	// Error flags: count the error code and track TEC/REC. LEC is set back to
+	// 0b111 (no new error), so the next error raises the interrupt again.
+	if (CAN->MSR & CAN_MSR_ERRI)
+	{
+		uint32_t esr = CAN->ESR;
+		error_can_lec((esr & CAN_ESR_LEC) >> CAN_ESR_LEC_Pos);
+		error_can_state(esr);
+		CAN->ESR = CAN_ESR_LEC;
+		CAN->MSR = CAN_MSR_ERRI;
+	}
+
+	// Handler duration in core cycles (SysTick counts down, one reload at most)
+	uint32_t end = SysTick->VAL;
+	isr_cycles_last = (start >= end) ? start - end : start + SysTick->LOAD + 1 - end;
+	if (isr_cycles_last > isr_cycles_max)
+	{
+		isr_cycles_max = isr_cycles_last;
+	}
+}
@@ -0,0 +1,141 @@
+//
+// candump: serialize CAN frames as candump text lines into the USB TX ring
+//
+// Hex digits come from a nibble table and decimal timestamps from repeated
+// subtraction of powers of ten, so a frame is printed without any division,
+// format string parsing or per-field USB transfer: each line is built in one
+// pass and queued with a single cdc_tx_write().
+//
+
+#include "stm32f0xx_hal.h"
+#include "usbd_cdc_if.h"
+#include "candump.h"
+
+
+// Private variables
+static const uint8_t hex_digit[16] = "0123456789ABCDEF";
+static const uint32_t pow10[9] = {
+    1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10
+};
+
+
+// Write a value in decimal with at least min_digits digits (zero padded)
+static uint8_t* candump_dec(uint8_t *p, uint32_t value, uint8_t min_digits)
+{
+    uint8_t started = 0;
+
+    for (uint8_t i = 0; i < 9; i++)
+    {
+        uint8_t digit = '0';
+        while (value >= pow10[i])
+        {
+            value -= pow10[i];
+            digit++;
+        }
+        if (started || digit != '0' || 10 - i <= min_digits)
+        {
+            *p++ = digit;
+            started = 1;
+        }
+    }
+    *p++ = '0' + value;
+    return p;
+}
+
+
+// Write "ID#DATA" or "ID#R<dlc>" followed by a newline
+static uint8_t* candump_frame(uint8_t *p, uint32_t id, uint32_t ide, uint32_t rtr, uint8_t dlc, const uint8_t *data)
+{
+    if (dlc > 8)
+    {
+        dlc = 8;
+    }
+
+    if (ide == CAN_ID_EXT)
+    {
+        for (int8_t shift = 28; shift >= 0; shift -= 4)
+        {
+            *p++ = hex_digit[(id >> shift) & 0xF];
+        }
+    }
+    else
+    {
+        *p++ = hex_digit[(id >> 8) & 0x7];
+        *p++ = hex_digit[(id >> 4) & 0xF];
+        *p++ = hex_digit[id & 0xF];
+    }
+    *p++ = '#';
+
+    if (rtr != CAN_RTR_DATA)
+    {
+        *p++ = 'R';
+        *p++ = '0' + dlc;
+    }
+    else
+    {
+        for (uint8_t i = 0; i < dlc; i++)
+        {
+            *p++ = hex_digit[data[i] >> 4];
+            *p++ = hex_digit[data[i] & 0xF];
+        }
+    }
+
+    *p++ = '\n';
+    return p;
+}
+
+
+// Encode a received frame: "123#0011223344556677\n"
+uint8_t candump_encode_rx(const CAN_RxHeaderTypeDef *rx_msg_header, const uint8_t *rx_msg_data, uint8_t *out)
+{
+    uint32_t id = (rx_msg_header->IDE == CAN_ID_EXT) ? rx_msg_header->ExtId : rx_msg_header->StdId;
+
+    return candump_frame(out, id, rx_msg_header->IDE, rx_msg_header->RTR, rx_msg_header->DLC, rx_msg_data) - out;
+}
+
+
+// Encode a transmitted frame as a candump -L comment: "# (12.345000) can0 123#0011223344556677\n"
+uint8_t candump_encode_tx(const CAN_TxHeaderTypeDef *tx_msg_header, const uint8_t *tx_msg_data, uint32_t tick, uint8_t *out)
+{
+    uint8_t *p = out;
+    uint32_t id = (tx_msg_header->IDE == CAN_ID_EXT) ? tx_msg_header->ExtId : tx_msg_header->StdId;
+
+    *p++ = '#';
+    *p++ = ' ';
+    *p++ = '(';
+
+    // Millisecond tick as "seconds.milliseconds": print the digits, then move
+    // the last three one place right to make room for the decimal point
+    p = candump_dec(p, tick, 4);
+    p[0] = p[-1];
+    p[-1] = p[-2];
+    p[-2] = p[-3];
+    p[-3] = '.';
+    p++;
+
+    const char *suffix = "000) can0 ";
+    while (*suffix)
+    {
+        *p++ = *suffix++;
+    }
+
+    return candump_frame(p, id, tx_msg_header->IDE, tx_msg_header->RTR, tx_msg_header->DLC, tx_msg_data) - out;
+}
+
+
+// Print a received frame to the USB CDC port
+void candump_rx_frame(const CAN_RxHeaderTypeDef *rx_msg_header, const uint8_t *rx_msg_data)
+{
+    uint8_t line[CANDUMP_MTU];
+
+    cdc_tx_write(line, candump_encode_rx(rx_msg_header, rx_msg_data, line));
+}
+
+
+// Print a transmitted frame to the USB CDC port
+void candump_tx_frame(const CAN_TxHeaderTypeDef *tx_msg_header, const uint8_t *tx_msg_data)
+{
+    uint8_t line[CANDUMP_MTU];
+
+    cdc_tx_write(line, candump_encode_tx(tx_msg_header, tx_msg_data, HAL_GetTick(), line));
+}
@@ -5,12 +5,28 @@
 
 #include "stm32f0xx_hal.h"
 #include "error.h"
+#include "printf.h"
 
 
 // Private variables
 static uint32_t err_reg = 0;
 static uint32_t err_time[ERR_MAX] = {0};
 
+// bxCAN error counters and state transitions
+static struct {
+	can_err_state_t state;
+	uint8_t tec;
+	uint8_t rec;
+	uint8_t tec_max;
+	uint8_t rec_max;
+	uint32_t lec[CAN_LEC_TYPES];
+	uint32_t passive;      // Transitions into error passive
+	uint32_t busoff;       // Transitions into bus-off
+	uint32_t state_tick;   // HAL_GetTick() of the last state change
+	uint32_t busoff_tick;  // HAL_GetTick() of the last bus-off
+	uint32_t recovery;     // Duration of the last bus-off (ms)
+} can_err;
+
 
 // Assert an error: sets err register bit and records timestamp
 void error_assert(error_t err)
@@ -46,3 +62,75 @@ uint32_t error_reg(void)
 {
 	return err_reg;
 }
+
+
+// Count a last error code of the bxCAN (CAN interrupt)
+void error_can_lec(uint8_t lec)
+{
+	if(lec >= 1 && lec <= CAN_LEC_TYPES)
+		can_err.lec[lec - 1]++;
+}
+
+
+// Track TEC/REC and the fault confinement state from CAN_ESR. Called from the
+// CAN interrupt and, with interrupts masked, from the main loop (leaving
+// bus-off raises no interrupt).
+void error_can_state(uint32_t esr)
+{
+	can_err_state_t state;
+
+	can_err.tec = (esr & CAN_ESR_TEC) >> CAN_ESR_TEC_Pos;
+	can_err.rec = (esr & CAN_ESR_REC) >> CAN_ESR_REC_Pos;
+	if(can_err.tec > can_err.tec_max)
+		can_err.tec_max = can_err.tec;
+	if(can_err.rec > can_err.rec_max)
+		can_err.rec_max = can_err.rec;
+
+	if(esr & CAN_ESR_BOFF)
+		state = CAN_ERR_BUSOFF;
+	else if(esr & CAN_ESR_EPVF)
+		state = CAN_ERR_PASSIVE;
+	else if(esr & CAN_ESR_EWGF)
+		state = CAN_ERR_WARNING;
+	else
+		state = CAN_ERR_ACTIVE;
+
+	if(state == can_err.state)
+		return;
+
+	if(state == CAN_ERR_BUSOFF){
+		can_err.busoff++;
+		can_err.busoff_tick = HAL_GetTick();
+		error_assert(ERR_CAN_BUSOFF);
+	} else if(state == CAN_ERR_PASSIVE && can_err.state < CAN_ERR_PASSIVE){
+		can_err.passive++;
+		error_assert(ERR_CAN_PASSIVE);
+	}
+	if(can_err.state == CAN_ERR_BUSOFF)
+		can_err.recovery = HAL_GetTick() - can_err.busoff_tick;
+
+	can_err.state = state;
+	can_err.state_tick = HAL_GetTick();
+}
+
+
+// Returns 1 while the node is error passive or bus-off
+uint8_t error_can_passive(void)
+{
+	return can_err.state >= CAN_ERR_PASSIVE;
+}
+
+
+// Print the bxCAN error counters and state history
+void error_can_report(void)
+{
+	static const char state_name[] = "AWPB";
+
+	printf_("E %c since:%u tec:%u/%u rec:%u/%u passive:%u busoff:%u recovery:%u lec:",
+		state_name[can_err.state], HAL_GetTick() - can_err.state_tick, can_err.tec, can_err.tec_max,
+		can_err.rec, can_err.rec_max, can_err.passive, can_err.busoff, can_err.recovery);
+	for(uint8_t i = 0; i < CAN_LEC_TYPES; i++){
+		printf_(i ? ",%u" : "%u", can_err.lec[i]);
+	}
+	printf_(" reg:%08X\n", err_reg);
+}
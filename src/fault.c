@@ -0,0 +1,86 @@
+//
+// fault: HardFault / NMI crash capture
+//
+// The exception handlers (interrupts.c) pass the stacked exception frame to
+// fault_capture(), which stores PC, LR, xPSR, SP and the error register in a
+// CRC-protected record in .noinit RAM and resets. At the next boot
+// fault_init() copies a valid record into the event journal, where it also
+// survives power loss, and keeps it for the F command. Symbolize with
+// tools/crash_symbolize.py.
+//
+
+#include "stm32f0xx_hal.h"
+#include <stddef.h>
+#include <string.h>
+#include "fault.h"
+#include "error.h"
+#include "journal.h"
+#include "system.h"
+#include "printf.h"
+
+
+// End of RAM (defined in STM32F042C6_FLASH.ld)
+extern uint32_t _estack;
+
+
+// Private variables
+static fault_record_t record __attribute__((section(".noinit")));
+static fault_record_t last;
+
+
+// Save the exception frame and reset. Runs in the fault handler: no HAL calls
+// that depend on interrupts, no stack beyond a few words.
+void fault_capture(uint32_t *frame, uint32_t source)
+{
+    record.magic = FAULT_MAGIC;
+    record.source = source;
+    record.sp = (uint32_t)frame;
+    record.pc = 0;
+    record.lr = 0;
+    record.xpsr = 0;
+
+    // The frame is only read if the faulting SP pointed into RAM
+    if(SRAM_BASE <= (uint32_t)frame && (uint32_t)(frame + 8) <= (uint32_t)&_estack + 1){
+        record.lr = frame[5];
+        record.pc = frame[6];
+        record.xpsr = frame[7];
+        // 8 stacked words, plus one of padding when bit 9 of the stacked xPSR is set
+        record.sp += 32 + ((record.xpsr & (1 << 9)) ? 4 : 0);
+    }
+    record.err_reg = error_reg();
+    record.tick = HAL_GetTick();
+    record.crc = system_crc32(&record, offsetof(fault_record_t, crc));
+
+    NVIC_SystemReset();
+}
+
+
+// Journal the record of a crash before this boot, if there is one.
+// Must run after journal_init().
+void fault_init(void)
+{
+    memset(&last, 0, sizeof(last));
+
+    if(record.magic != FAULT_MAGIC || record.crc != system_crc32(&record, offsetof(fault_record_t, crc)))
+        return;
+
+    last = record;
+    record.magic = 0;
+
+    // 32K flash and 6K RAM: the low 16 bits identify the address, bit 7 of a marks RAM (RAMFUNC code)
+    journal_log(EVT_FAULT, last.source | ((last.pc >> 29) & 1) << 7, (uint8_t)last.err_reg);
+    journal_log(EVT_FAULT_PC, last.pc >> 8, last.pc);
+    journal_log(EVT_FAULT_LR, last.lr >> 8, last.lr);
+}
+
+
+// Print the crash record found at boot
+void fault_report(void)
+{
+    if(last.source == FAULT_NONE){
+        printf_("F none\n");
+        return;
+    }
+    printf_("F src:%u pc:%08X lr:%08X psr:%08X sp:%08X err:%08X tick:%u\n",
+            last.source, last.pc, last.lr, last.xpsr, last.sp, last.err_reg, last.tick);
+}
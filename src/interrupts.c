@@ -5,6 +5,8 @@
 #include "stm32f0xx_hal.h"
 #include "interrupts.h"
 #include "can.h"
+#include "system.h"
+#include "fault.h"
 
 
 
@@ -13,14 +15,38 @@ extern PCD_HandleTypeDef hpcd_USB_FS;
 
 
 
-void NMI_Handler(void)
+// Fault handlers: pass the exception frame (on MSP or PSP, see EXC_RETURN bit 2)
+// and the source to fault_capture(), which records it and resets
+__attribute__((naked)) void NMI_Handler(void)
 {
-	while(1);
+	__asm volatile(
+		"movs r0, #4        \n"
+		"mov  r1, lr        \n"
+		"tst  r0, r1        \n"
+		"beq  1f            \n"
+		"mrs  r0, psp       \n"
+		"b    2f            \n"
+		"1: mrs r0, msp     \n"
+		"2: movs r1, #2     \n" // FAULT_NMI
+		"ldr  r2, =fault_capture \n"
+		"bx   r2            \n"
+	);
 }
 
-void HardFault_Handler(void)
+__attribute__((naked)) void HardFault_Handler(void)
 {
-	while(1);
+	__asm volatile(
+		"movs r0, #4        \n"
+		"mov  r1, lr        \n"
+		"tst  r0, r1        \n"
+		"beq  1f            \n"
+		"mrs  r0, psp       \n"
+		"b    2f            \n"
+		"1: mrs r0, msp     \n"
+		"2: movs r1, #1     \n" // FAULT_HARDFAULT
+		"ldr  r2, =fault_capture \n"
+		"bx   r2            \n"
+	);
 }
 
 
@@ -39,8 +65,15 @@ void SysTick_Handler(void)
 }
 
 
-// Handle CAN interrupts
-void CEC_CAN_IRQHandler(void)
+// CAN RX pin edge while parked in Stop mode (see can_sleep)
+void EXTI4_15_IRQHandler(void)
 {
-    HAL_CAN_IRQHandler(can_gethandle());
+    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_8);
+}
+
+
+// Handle CAN interrupts (only FIFO0 message pending is enabled)
+RAMFUNC void CEC_CAN_IRQHandler(void)
+{
+    can_rx_isr();
 }
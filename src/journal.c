@@ -0,0 +1,250 @@
+//
+// journal: append-only, wear-levelled event journal in the reserved flash pages
+//
+// The JOURNAL region of the linker script is used as a ring of 8-byte records.
+// Records are appended until the end of the region, then the oldest page is
+// erased and writing wraps around, so every page sees the same number of
+// erase cycles. Events are first staged in RAM by journal_log() and programmed
+// later from the main loop by journal_process(), never from frame handling.
+//
+// A page erase stalls the flash, and with it the CPU, for 20-40 ms. It is only
+// done while the engine is stopped: the page ahead of the write position is
+// erased while parked, and records reaching a page that is not erased yet stay
+// staged until the next stop.
+//
+
+#include "stm32f0xx_hal.h"
+#include <string.h>
+#include "journal.h"
+#include "error.h"
+#include "printf.h"
+#include "avh.h"
+
+
+// Journal region (defined in STM32F042C6_FLASH.ld)
+extern uint32_t _sjournal;
+extern uint32_t _ejournal;
+
+#define JOURNAL_START ((uint32_t)&_sjournal)
+#define JOURNAL_END   ((uint32_t)&_ejournal)
+#define JOURNAL_SLOTS ((JOURNAL_END - JOURNAL_START) / sizeof(journal_record_t))
+
+
+// Private variables
+static journal_record_t stage[JOURNAL_STAGE_LEN];
+static uint8_t stage_head = 0;
+static uint8_t stage_tail = 0;
+static uint32_t write_slot = 0;
+static uint32_t dropped = 0;
+static uint32_t logged_err_reg = 0;
+static uint32_t ready_page = 0; // Page ahead of the write position known to be erased
+
+
+// Return pointer to a journal slot in flash
+static const journal_record_t* journal_slot(uint32_t slot)
+{
+    return (const journal_record_t*)(JOURNAL_START + slot * sizeof(journal_record_t));
+}
+
+
+// Calculate the check byte of a record
+static uint8_t journal_checksum(const journal_record_t* rec)
+{
+    const uint8_t* p = (const uint8_t*)rec;
+    uint8_t sum = 0x5A;
+
+    for(uint8_t i = 0; i < sizeof(journal_record_t) - 1; i++){
+        sum += p[i];
+    }
+    return sum;
+}
+
+
+// Returns 1 if the slot has never been programmed since the last erase
+static uint8_t journal_slot_empty(uint32_t slot)
+{
+    const uint32_t* p = (const uint32_t*)journal_slot(slot);
+    return (p[0] == 0xFFFFFFFF && p[1] == 0xFFFFFFFF);
+}
+
+
+// Returns 1 if the whole page at addr is erased
+static uint8_t journal_page_blank(uint32_t addr)
+{
+    const uint32_t* p = (const uint32_t*)addr;
+
+    for(uint32_t i = 0; i < FLASH_PAGE_SIZE / sizeof(uint32_t); i++){
+        if(p[i] != 0xFFFFFFFF){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+// Start of the next page the write position moves into: its own page when it
+// is at a page start, otherwise the following one
+static uint32_t journal_next_page(void)
+{
+    uint32_t addr = (uint32_t)journal_slot(write_slot);
+
+    if((addr % FLASH_PAGE_SIZE) != 0){
+        addr += FLASH_PAGE_SIZE - (addr % FLASH_PAGE_SIZE);
+    }
+    return (addr < JOURNAL_END) ? addr : JOURNAL_START;
+}
+
+
+// Returns 1 if the write position is at the start of a page that is not erased yet
+static uint8_t journal_blocked(void)
+{
+    uint32_t addr = (uint32_t)journal_slot(write_slot);
+    return (addr % FLASH_PAGE_SIZE) == 0 && addr != ready_page;
+}
+
+
+// Returns 1 if the page ahead is to be erased now: parked, and not given up
+// after a flash error (until the next reset)
+static uint8_t journal_erase_due(void)
+{
+    return journal_next_page() != ready_page && avh_engine_stopped() && !error_occurred(ERR_FLASH);
+}
+
+
+// Locate the write position: the first empty slot following a programmed one
+void journal_init(void)
+{
+    write_slot = 0;
+    for(uint32_t slot = 0; slot < JOURNAL_SLOTS; slot++){
+        uint32_t prev = (slot == 0) ? JOURNAL_SLOTS - 1 : slot - 1;
+        if(journal_slot_empty(slot) && !journal_slot_empty(prev)){
+            write_slot = slot;
+            break;
+        }
+    }
+    stage_head = 0;
+    stage_tail = 0;
+    logged_err_reg = 0;
+    ready_page = journal_page_blank(journal_next_page()) ? journal_next_page() : 0;
+}
+
+
+// Stage an event for programming into flash. Must only be called from the main loop.
+void journal_log(uint8_t event, uint8_t a, uint8_t b)
+{
+    uint8_t next = (stage_head + 1) % JOURNAL_STAGE_LEN;
+
+    if(next == stage_tail){
+        dropped++;
+        return;
+    }
+
+    stage[stage_head].tick = HAL_GetTick();
+    stage[stage_head].event = event;
+    stage[stage_head].a = a;
+    stage[stage_head].b = b;
+    stage[stage_head].check = journal_checksum(&stage[stage_head]);
+    stage_head = next;
+}
+
+
+// Program at most one staged record into flash, or erase the page ahead while
+// the engine is stopped
+void journal_process(void)
+{
+    // Record newly asserted errors (error_assert() may run in interrupt context)
+    uint32_t err = error_reg();
+    if(err != logged_err_reg){
+        for(uint8_t i = 0; i < ERR_MAX; i++){
+            if((err & ~logged_err_reg) & (1 << i)){
+                journal_log(EVT_ERROR, i, (uint8_t)err);
+            }
+        }
+        logged_err_reg = err;
+    }
+
+    // Parked: erase the page ahead (discards the oldest records), one page per call
+    if(journal_erase_due()){
+        uint32_t next = journal_next_page();
+
+        if(journal_page_blank(next)){
+            ready_page = next;
+            return;
+        }
+
+        FLASH_EraseInitTypeDef erase;
+        uint32_t page_error = 0;
+
+        erase.TypeErase = FLASH_TYPEERASE_PAGES;
+        erase.PageAddress = next;
+        erase.NbPages = 1;
+        HAL_FLASH_Unlock();
+        HAL_StatusTypeDef status = HAL_FLASHEx_Erase(&erase, &page_error);
+        HAL_FLASH_Lock();
+
+        if(status == HAL_OK && journal_page_blank(next)){
+            ready_page = next;
+        } else {
+            error_assert(ERR_FLASH);
+        }
+        return;
+    }
+
+    // Driving into a page that is not erased yet: keep the records staged
+    if(stage_tail == stage_head || journal_blocked()){
+        return;
+    }
+
+    uint32_t addr = (uint32_t)journal_slot(write_slot);
+
+    // Slot was programmed but not erased (e.g. power loss during a write): skip it
+    if(!journal_slot_empty(write_slot)){
+        write_slot = (write_slot + 1) % JOURNAL_SLOTS;
+        return;
+    }
+
+    uint64_t data;
+    memcpy(&data, &stage[stage_tail], sizeof(data));
+    HAL_FLASH_Unlock();
+    HAL_StatusTypeDef status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, addr, data);
+    HAL_FLASH_Lock();
+
+    // A failed slot is skipped, the record stays staged for the next one
+    if(status == HAL_OK && memcmp((const void*)addr, &data, sizeof(data)) == 0){
+        stage_tail = (stage_tail + 1) % JOURNAL_STAGE_LEN;
+    } else {
+        error_assert(ERR_FLASH);
+    }
+    write_slot = (write_slot + 1) % JOURNAL_SLOTS;
+}
+
+
+// Returns 1 if journal_process() has work: staged records it may program, or
+// the page ahead to erase while parked
+uint8_t journal_pending(void)
+{
+    return error_reg() != logged_err_reg || journal_erase_due() || (stage_tail != stage_head && !journal_blocked());
+}
+
+
+// Stream the journal out over USB CDC, oldest record first
+void journal_dump(void)
+{
+    for(uint32_t i = 0; i < JOURNAL_SLOTS; i++){
+        uint32_t slot = (write_slot + i) % JOURNAL_SLOTS;
+        const journal_record_t* rec = journal_slot(slot);
+
+        if(journal_slot_empty(slot) || rec->check != journal_checksum(rec)){
+            continue;
+        }
+        printf_("J%08X%02X%02X%02X\n", rec->tick, rec->event, rec->a, rec->b);
+    }
+    printf_("J end %u\n", dropped);
+}
+
+
+// Number of events dropped because the staging buffer was full
+uint32_t journal_dropped(void)
+{
+    return dropped;
+}
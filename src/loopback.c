@@ -0,0 +1,106 @@
+//
+// loopback: on-target RX pipeline benchmark without a vehicle
+//
+// The bxCAN is switched to silent loopback, so nothing reaches the bus, and a
+// script of VN5 frames is sent through the normal TX queue and mailboxes. Each
+// frame comes back through the RX interrupt and ring and is handed to
+// avh_process(), like in the main loop. TIM2 (1 us) times two spans per frame:
+// from the RX interrupt to the decision (cpu), and from queueing the frame to
+// the decision (lat, includes the time on the bus). The controller state is
+// saved before the run and restored afterwards.
+//
+
+#include "stm32f0xx_hal.h"
+#include "loopback.h"
+#include "can.h"
+#include "avh.h"
+#include "printf.h"
+#include "subaru_levorg_vnx.h"
+
+
+// Standing in D, brake released, doors and belt closed. 0x6BB is left out: it
+// would run the engine start sequence.
+static const struct {
+    uint16_t id;
+    uint8_t data[8];
+} script[] = {
+    { CAN_ID_ACCEL,      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 } },
+    { CAN_ID_SHIFT,      { 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00 } },
+    { CAN_ID_SPEED,      { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 } },
+    { CAN_ID_EYESIGHT,   { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 } },
+    { CAN_ID_AVH_STATUS, { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 } },
+    { CAN_ID_BELT,       { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 } },
+    { CAN_ID_DOOR,       { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 } },
+};
+
+#define SCRIPT_LEN (sizeof(script) / sizeof(script[0]))
+
+
+// Run count frames through the loopback and report throughput and latencies.
+// Only while the engine is stopped: the node is off the bus during the run.
+int8_t loopback_bench(uint32_t count)
+{
+    CAN_TxHeaderTypeDef tx_msg_header;
+    CAN_RxHeaderTypeDef rx_msg_header;
+    uint8_t rx_msg_data[8];
+    uint32_t tx_time[LOOPBACK_INFLIGHT];
+    uint32_t sent = 0;
+    uint32_t received = 0;
+    uint32_t cpu_sum = 0;
+    uint32_t cpu_max = 0;
+    uint32_t lat_max = 0;
+    avh_state_t saved;
+
+    if(!avh_engine_stopped())
+        return -1;
+
+    avh_save(&saved);
+    can_disable();
+    can_set_loopback(1);
+    can_enable();
+
+    tx_msg_header.IDE = CAN_ID_STD;
+    tx_msg_header.ExtId = 0;
+    tx_msg_header.RTR = CAN_RTR_DATA;
+    tx_msg_header.DLC = 8;
+    tx_msg_header.TransmitGlobalTime = DISABLE;
+
+    uint32_t start_tick = HAL_GetTick();
+    uint32_t start = can_timestamp();
+    while(received < count && HAL_GetTick() - start_tick < LOOPBACK_TIMEOUT){
+        if(sent < count && sent - received < LOOPBACK_INFLIGHT){
+            tx_msg_header.StdId = script[sent % SCRIPT_LEN].id;
+            if(can_tx(&tx_msg_header, (uint8_t *)script[sent % SCRIPT_LEN].data) == HAL_OK){
+                tx_time[sent % LOOPBACK_INFLIGHT] = can_timestamp();
+                sent++;
+            }
+        }
+        can_process();
+
+        while(is_can_msg_pending(CAN_RX_FIFO0)){
+            can_rx(&rx_msg_header, rx_msg_data);
+            avh_process(&rx_msg_header, rx_msg_data);
+
+            uint32_t now = can_timestamp();
+            uint32_t cpu = now - rx_msg_header.Timestamp;
+            uint32_t lat = now - tx_time[received % LOOPBACK_INFLIGHT];
+            cpu_sum += cpu;
+            if(cpu_max < cpu)
+                cpu_max = cpu;
+            if(lat_max < lat)
+                lat_max = lat;
+            received++;
+        }
+    }
+    uint32_t elapsed_ms = (can_timestamp() - start) / 1000;
+
+    can_disable();
+    can_set_loopback(0);
+    can_enable();
+    avh_restore(&saved);
+    avh_led();
+
+    printf_("L %u %u fps:%u cpu:%u/%u lat:%u\n", received, elapsed_ms,
+            elapsed_ms ? received * 1000 / elapsed_ms : 0, received ? cpu_sum / received : 0, cpu_max, lat_max);
+    return 0;
+}
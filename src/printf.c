@@ -33,6 +33,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "stm32f0xx_hal.h"
 #include "printf.h"
 #include "usbd_cdc_if.h"
 
@@ -156,6 +157,38 @@ static inline void _out_char(char character, void* buffer, size_t idx, size_t ma
 }
 
 
+// longest time printf_() waits for the host to drain a full USB TX ring, in ms
+#ifndef PRINTF_RING_TIMEOUT
+#define PRINTF_RING_TIMEOUT    5U
+#endif
+
+// USB TX ring output state
+static bool _ring_stalled = false;
+static uint32_t _ring_truncated = 0U;
+
+
+// internal USB TX ring output, buffer points to the tick the message was started at.
+// A full ring is drained by waiting for the host; if it does not read for
+// PRINTF_RING_TIMEOUT ms, the rest of the output is dropped (and counted) without
+// waiting until the ring has room again.
+static void _out_ring(char character, void* buffer, size_t idx, size_t maxlen)
+{
+  (void)idx; (void)maxlen;
+  if (!character) {
+    return;
+  }
+  while (!cdc_tx_putc((uint8_t)character)) {
+    if (_ring_stalled || (HAL_GetTick() - *(uint32_t*)buffer) > PRINTF_RING_TIMEOUT) {
+      _ring_stalled = true;
+      _ring_truncated++;
+      return;
+    }
+    cdc_tx_process();
+  }
+  _ring_stalled = false;
+}
+
+
 // internal output function wrapper
 static inline void _out_fct(char character, void* buffer, size_t idx, size_t maxlen)
 {
@@ -875,16 +908,22 @@ int printf_(const char* format, ...)
 
 int printf_(const char* format, ...)
 {
-  char buffer[64];
+  uint32_t start = HAL_GetTick();
   va_list va;
   va_start(va, format);
-  const int ret = _vsnprintf(_out_buffer, buffer, (size_t)-1, format, va);
+  const int ret = _vsnprintf(_out_ring, (char*)&start, (size_t)-1, format, va);
   va_end(va);
-  CDC_Transmit_FS(buffer, ret);
+  cdc_tx_process();
   return ret;
 }
 
 
+uint32_t printf_truncated(void)
+{
+  return _ring_truncated;
+}
+
+
 int sprintf_(char* buffer, const char* format, ...)
 {
   va_list va;
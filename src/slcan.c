@@ -0,0 +1,103 @@
+//
+// slcan: full-bus sniffer mode, streaming every received frame in SLCAN/Lawicel format
+//
+// Frames are encoded with a nibble lookup table into the batched USB TX ring,
+// so sniffing costs no printf_ and no per-frame USB transfer. The AVH logic
+// keeps running on the same frames.
+//
+
+#include "stm32f0xx_hal.h"
+#include "can.h"
+#include "usbd_cdc_if.h"
+#include "printf.h"
+#include "slcan.h"
+
+
+// Private variables
+static const uint8_t hex_digit[16] = "0123456789ABCDEF";
+static uint8_t sniffer_enabled = 0;
+static uint32_t sniffer_frames = 0;
+static uint32_t sniffer_dropped = 0;
+
+
+// Encode a frame as an SLCAN line (tIIIL[DD..]\r, TIIIIIIIIL[DD..]\r, rIIIL\r, RIIIIIIIIL\r)
+// Returns the line length (at most SLCAN_MTU)
+uint8_t slcan_encode(const CAN_RxHeaderTypeDef *rx_msg_header, const uint8_t *rx_msg_data, uint8_t *out)
+{
+    uint8_t *p = out;
+    uint8_t dlc = (rx_msg_header->DLC > 8) ? 8 : rx_msg_header->DLC;
+    uint8_t remote = (rx_msg_header->RTR != CAN_RTR_DATA);
+
+    if (rx_msg_header->IDE == CAN_ID_EXT)
+    {
+        uint32_t id = rx_msg_header->ExtId;
+        *p++ = remote ? 'R' : 'T';
+        for (int8_t shift = 28; shift >= 0; shift -= 4)
+        {
+            *p++ = hex_digit[(id >> shift) & 0xF];
+        }
+    }
+    else
+    {
+        uint32_t id = rx_msg_header->StdId;
+        *p++ = remote ? 'r' : 't';
+        *p++ = hex_digit[(id >> 8) & 0x7];
+        *p++ = hex_digit[(id >> 4) & 0xF];
+        *p++ = hex_digit[id & 0xF];
+    }
+
+    *p++ = '0' + dlc;
+
+    if (!remote)
+    {
+        for (uint8_t i = 0; i < dlc; i++)
+        {
+            *p++ = hex_digit[rx_msg_data[i] >> 4];
+            *p++ = hex_digit[rx_msg_data[i] & 0xF];
+        }
+    }
+
+    *p++ = '\r';
+    return p - out;
+}
+
+
+// Stream one received frame if sniffer mode is enabled
+void slcan_frame(const CAN_RxHeaderTypeDef *rx_msg_header, const uint8_t *rx_msg_data)
+{
+    uint8_t line[SLCAN_MTU];
+
+    if (!sniffer_enabled)
+    {
+        return;
+    }
+
+    uint8_t len = slcan_encode(rx_msg_header, rx_msg_data, line);
+    sniffer_frames++;
+    if (cdc_tx_write(line, len) != len)
+    {
+        sniffer_dropped++;
+    }
+}
+
+
+// Enable/disable sniffer mode: open the filters to accept all frames while enabled
+void slcan_set_enabled(uint8_t enabled)
+{
+    sniffer_enabled = (enabled != 0);
+    can_set_accept_all(sniffer_enabled);
+}
+
+
+// Returns 1 if sniffer mode is enabled
+uint8_t slcan_enabled(void)
+{
+    return sniffer_enabled;
+}
+
+
+// Report sniffer state, dropped frames and dropped text output
+void slcan_report(void)
+{
+    printf_("M %d frames:%u rx_dropped:%u usb_dropped:%u text_dropped:%u\n", sniffer_enabled, sniffer_frames, can_rx_dropped(), sniffer_dropped, printf_truncated());
+}
@@ -0,0 +1,112 @@
+//
+// supervisor: main loop latency accounting and independent watchdog
+//
+// Every main loop iteration is timed from the end of system_idle() to the
+// start of the next one, so sleeping does not count. Iteration times go into
+// a log2 histogram; iterations above SUPERVISOR_BUDGET_US are deadline misses.
+// Intended waits through supervisor_delay() are taken out of the iteration.
+// Once started, the IWDG is refreshed only at the end of an iteration that
+// left the CAN RX ring less than half full, so a loop that stops draining the
+// bus is reset within the IWDG timeout instead of silently dropping frames.
+//
+
+#include "stm32f0xx_hal.h"
+#include "supervisor.h"
+#include "can.h"
+#include "error.h"
+#include "printf.h"
+
+
+// Private variables
+static uint8_t running = 0;
+static uint8_t in_loop = 0;
+static uint32_t loop_start = 0;
+static uint32_t loop_max = 0;
+static uint32_t misses = 0;
+static uint32_t waited = 0;
+static uint32_t histogram[SUPERVISOR_BUCKETS] = {0};
+
+
+// Start the IWDG. It cannot be stopped again, only a reset does that.
+void supervisor_start(void)
+{
+    if(running)
+        return;
+
+    IWDG->KR = 0xCCCC; // Start, also enables LSI
+    IWDG->KR = 0x5555; // Unlock PR and RLR
+    IWDG->PR = SUPERVISOR_IWDG_PR;
+    IWDG->RLR = SUPERVISOR_IWDG_RLR;
+    while(IWDG->SR);
+    IWDG->KR = 0xAAAA; // Refresh with the new reload value
+    running = 1;
+}
+
+
+// Returns 1 if the IWDG has been started
+uint8_t supervisor_running(void)
+{
+    return running;
+}
+
+
+// Mark the start of a main loop iteration (after the idle sleep)
+void supervisor_loop_begin(void)
+{
+    loop_start = can_timestamp();
+    in_loop = 1;
+}
+
+
+// Account the iteration and refresh the IWDG if the CAN RX path keeps up
+void supervisor_loop_end(void)
+{
+    if(!in_loop)
+        return;
+    in_loop = 0;
+
+    uint32_t elapsed = can_timestamp() - loop_start;
+    uint32_t scaled = elapsed / 125;
+    uint8_t bucket = 0;
+
+    while(scaled && bucket < SUPERVISOR_BUCKETS - 1){
+        scaled >>= 1;
+        bucket++;
+    }
+    histogram[bucket]++;
+
+    if(loop_max < elapsed)
+        loop_max = elapsed;
+
+    if(SUPERVISOR_BUDGET_US < elapsed){
+        misses++;
+        error_assert(ERR_LOOP_DEADLINE);
+    }
+
+    if(running && can_rx_depth() < RXRING_LEN / 2)
+        IWDG->KR = 0xAAAA;
+}
+
+
+// Blocking wait that is part of the design (the AVH retry delay): the time is
+// not counted against the loop budget, only against the IWDG
+void supervisor_delay(uint32_t ms)
+{
+    uint32_t start = can_timestamp();
+
+    HAL_Delay(ms);
+    loop_start += can_timestamp() - start;
+    waited += ms;
+}
+
+
+// Print watchdog state, worst iteration (us), deadline misses, intended waits (ms)
+// and the histogram
+void supervisor_report(void)
+{
+    printf_("W wdg:%d max:%u miss:%u wait:%u hist:", running, loop_max, misses, waited);
+    for(uint8_t i = 0; i < SUPERVISOR_BUCKETS; i++){
+        printf_(i ? ",%u" : "%u", histogram[i]);
+    }
+    printf_("\n");
+}
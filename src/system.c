@@ -4,6 +4,20 @@
 
 #include "stm32f0xx_hal.h"
 #include "system.h"
+#include "printf.h"
+
+
+// RAM layout (defined in STM32F042C6_FLASH.ld)
+extern uint32_t _sdata, _edata, _sbss, _ebss, _snoinit, _enoinit, _end, _estack;
+
+#define STACK_PAINT 0xC5C5C5C5
+#define STACK_TOP ((uint32_t *)((uint32_t)&_estack + 1))
+
+
+// Private variables
+static uint32_t idle_cycles = 0; // Sleep time below one tick
+static uint32_t idle_ticks = 0;
+static uint32_t idle_window_tick = 0;
 
 
 // Initialize system clocks
@@ -40,7 +54,16 @@ void system_init(void)
     HAL_SYSTICK_Config(HAL_RCC_GetHCLKFreq()/1000);
     HAL_SYSTICK_CLKSourceConfig(SYSTICK_CLKSOURCE_HCLK);
     HAL_NVIC_SetPriority(SysTick_IRQn, 0, 0);
+    __HAL_RCC_GPIOF_CLK_ENABLE();
+    __HAL_RCC_GPIOA_CLK_ENABLE();
+    __HAL_RCC_GPIOB_CLK_ENABLE();
+}
 
+
+// Trim HSI48 to the USB start of frame. Only useful with USB attached, so this
+// runs together with usb_init() after the CAN bus is live.
+void system_crs_init(void)
+{
     // Enable clock recovery system for internal oscillator
     RCC_CRSInitTypeDef RCC_CRSInitStruct;
     __HAL_RCC_CRS_CLK_ENABLE();
@@ -63,11 +86,6 @@ void system_init(void)
 
     // Start automatic synchronization 
     HAL_RCCEx_CRSConfig(&RCC_CRSInitStruct);
-	
-    HAL_NVIC_SetPriority(SysTick_IRQn, 0, 0);
-    __HAL_RCC_GPIOF_CLK_ENABLE();
-    __HAL_RCC_GPIOA_CLK_ENABLE();
-    __HAL_RCC_GPIOB_CLK_ENABLE();
 }
 
 
@@ -103,3 +121,134 @@ void system_irq_enable(void)
         __enable_irq();
 }
 
+
+
+// Switch SYSCLK back to HSI48 after Stop mode, which wakes up on HSI (8 MHz).
+// Only the oscillator and the clock switch are touched: flash latency, SysTick,
+// CRS and all HAL state are still valid from system_init(). Also used on USB resume.
+void system_clock_restore(void)
+{
+	if ((RCC->CFGR & RCC_CFGR_SWS) == RCC_CFGR_SWS_HSI48)
+		return;
+
+	RCC->CR2 |= RCC_CR2_HSI48ON;
+	while (!(RCC->CR2 & RCC_CR2_HSI48RDY));
+
+	RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | RCC_CFGR_SW_HSI48;
+	while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_HSI48);
+}
+
+
+// Enter Stop mode until an EXTI wakeup, then restore the 48 MHz clock.
+// The tick does not advance while stopped.
+void system_stop(void)
+{
+	__HAL_RCC_PWR_CLK_ENABLE();
+	HAL_SuspendTick();
+	HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_STOPENTRY_WFI);
+	system_clock_restore();
+	HAL_ResumeTick();
+}
+
+
+// Core clock cycle counter built from the millisecond tick and SysTick->VAL
+// (Cortex-M0 has no DWT cycle counter). Wraps after about 89 s, use for differences.
+uint32_t system_cycles(void)
+{
+	uint32_t tick;
+	uint32_t val;
+
+	do {
+		tick = HAL_GetTick();
+		val = SysTick->VAL;
+	} while (tick != HAL_GetTick());
+
+	return tick * (SysTick->LOAD + 1) + (SysTick->LOAD - val);
+}
+
+
+// Sleep until the next interrupt unless work_pending() reports work. The check runs
+// with interrupts masked, so an interrupt arriving between the check and WFI is not
+// lost: it still ends WFI, and its handler runs as soon as interrupts are enabled.
+void system_idle(uint8_t (*work_pending)(void))
+{
+	uint32_t start = system_cycles();
+
+	__disable_irq();
+	if (work_pending()) {
+		__enable_irq();
+		return;
+	}
+	__WFI();
+	__enable_irq();
+
+	// Measured after the wakeup handler has updated the tick
+	idle_cycles += system_cycles() - start;
+	while (idle_cycles > SysTick->LOAD) {
+		idle_cycles -= SysTick->LOAD + 1;
+		idle_ticks++;
+	}
+}
+
+
+// Share of time spent in WFI since the previous call, in percent
+uint8_t system_idle_percent(void)
+{
+	uint32_t now = HAL_GetTick();
+	uint32_t window = now - idle_window_tick;
+	uint8_t percent = window ? (idle_ticks * 100) / window : 0;
+
+	idle_ticks = 0;
+	idle_window_tick = now;
+	return percent;
+}
+
+
+// Fill the free RAM between the end of the static data and the current stack
+// pointer with a pattern. Call first thing in main(), so the stack is still shallow.
+void system_stack_paint(void)
+{
+	uint32_t *p = &_end;
+	uint32_t *sp = (uint32_t *)__get_MSP() - 8; // Leave this frame alone
+
+	while (p < sp)
+		*p++ = STACK_PAINT;
+}
+
+
+// Stack high-water mark: bytes between the static data and the deepest stack
+// use so far (pattern still intact)
+uint32_t system_stack_free(void)
+{
+	uint32_t *p = &_end;
+
+	while (p < STACK_TOP && *p == STACK_PAINT)
+		p++;
+	return (p - &_end) * 4;
+}
+
+
+// Print the RAM layout and the stack high-water mark
+void system_ram_report(void)
+{
+	uint32_t size = (STACK_TOP - &_end) * 4;
+	uint32_t free = system_stack_free();
+
+	printf_("S stack:%u/%u free:%u data:%u bss:%u noinit:%u\n", size - free, size, free,
+		(&_edata - &_sdata) * 4, (&_ebss - &_sbss) * 4, (&_enoinit - &_snoinit) * 4);
+}
+
+
+// Calculate CRC-32 (IEEE 802.3) of a buffer
+uint32_t system_crc32(const void *data, uint32_t len)
+{
+	const uint8_t *p = data;
+	uint32_t crc = 0xFFFFFFFF;
+
+	while (len--) {
+		crc ^= *p++;
+		for (uint8_t i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
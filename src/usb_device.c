@@ -1,5 +1,5 @@
 //
-// usb_device: start the USB-CDC interface
+// usb_device: start the USB-CDC interface (or the gs_usb interface with USB_GSUSB)
 //
 
 #include "usb_device.h"
@@ -7,20 +7,31 @@
 #include "usbd_desc.h"
 #include "usbd_cdc.h"
 #include "usbd_cdc_if.h"
+#include "usbd_gs_usb.h"
 
 
 // USB Device Core handle declaration.
 USBD_HandleTypeDef hUsbDeviceFS;
 
-// Init USB device, add CDC class and start the library
+// Init USB device, add CDC (or gs_usb) class and start the library
 void usb_init(void)
 {
   USBD_Init(&hUsbDeviceFS, &FS_Desc, DEVICE_FS);
+#ifdef USB_GSUSB
+  USBD_RegisterClass(&hUsbDeviceFS, &USBD_GS_USB);
+#else
   USBD_RegisterClass(&hUsbDeviceFS, &USBD_CDC);
   USBD_CDC_RegisterInterface(&hUsbDeviceFS, &USBD_Interface_fops_FS);
+#endif
   USBD_Start(&hUsbDeviceFS);
 }
 
+// Returns 1 if a host has configured the device
+uint8_t usb_configured(void)
+{
+  return hUsbDeviceFS.dev_state == USBD_STATE_CONFIGURED;
+}
+
 void usb_stop(void)
 {
   USBD_Stop(&hUsbDeviceFS);
@@ -4,15 +4,16 @@
 
 #include "usbd_cdc_if.h"
 #include "avhcontroller.h"
-#include "system.h"
 #include "error.h"
 
 // Private variables
 static volatile usbrx_buf_t rxbuf = {0};
 static uint8_t txbuf[TX_BUF_SIZE];
+static uint8_t txring[TX_RING_SIZE]; // Batched TX: filled by cdc_tx_write(), sent by cdc_tx_process()
+static uint16_t txring_head = 0;
+static uint16_t txring_tail = 0;
+static uint16_t txring_inflight = 0;
 extern USBD_HandleTypeDef hUsbDeviceFS;
-static uint8_t avhcontroller_str[AVHCONTROLLER_MTU];
-static uint8_t avhcontroller_str_index = 0;
 
 
 // Private function prototypes
@@ -151,8 +152,10 @@ static int8_t CDC_Receive_FS (uint8_t* Buf, uint32_t *Len)
 	}
 	else
 	{
-		// Save off length
+		// Save off length, then publish the buffer to the main loop.
+		// The barrier orders the length/data writes before the head update.
 		rxbuf.msglen[rxbuf.head] = *Len;
+		__DMB();
 		rxbuf.head = (rxbuf.head + 1) % NUM_RX_BUFS;
 
 		// Start listening on next buffer. Previous buffer will be processed in main loop.
@@ -164,45 +167,39 @@ static int8_t CDC_Receive_FS (uint8_t* Buf, uint32_t *Len)
 }
 
 
-// Process incoming USB-CDC messages from RX FIFO
+// Returns 1 if a received packet is waiting for cdc_process()
+uint8_t cdc_rx_pending(void)
+{
+	return rxbuf.tail != rxbuf.head;
+}
+
+
+// Process incoming USB-CDC messages from RX FIFO.
+// Single producer (CDC_Receive_FS, USB IRQ) / single consumer (this function):
+// the ISR only writes head, the main loop only writes tail, so no lock is needed
+// and interrupts stay enabled while commands run.
 void cdc_process(void)
 {
-	system_irq_disable();
 	if(rxbuf.tail != rxbuf.head)
 	{
-		//  Process one whole buffer
-		for (uint32_t i = 0; i < rxbuf.msglen[rxbuf.tail]; i++)
-		{
-		   if (rxbuf.buf[rxbuf.tail][i] == '\r')
-		   {
-			   int8_t result = avhcontroller_parse_str(avhcontroller_str, avhcontroller_str_index);
-
-			   // Success
-			   //if(result == 0)
-			   //    CDC_Transmit_FS("\n", 1);
-			   // Failure
-			   //else
-			   //    CDC_Transmit_FS("\a", 1);
-
-			   avhcontroller_str_index = 0;
-		   }
-		   else
-		   {
-			   // Check for overflow of buffer
-			   if(avhcontroller_str_index >= AVHCONTROLLER_MTU)
-			   {
-				   // TODO: Return here and discard this CDC buffer?
-				   avhcontroller_str_index = 0;
-			   }
-
-			   avhcontroller_str[avhcontroller_str_index++] = rxbuf.buf[rxbuf.tail][i];
-		   }
-		}
-
-		// Move on to next buffer
+		// Read the buffer only after observing the new head
+		__DMB();
+
+		//  Process one whole buffer in place
+		int8_t result = avhcontroller_parse((const uint8_t *)rxbuf.buf[rxbuf.tail], rxbuf.msglen[rxbuf.tail]);
+
+		// Success
+		//if(result == 0)
+		//    CDC_Transmit_FS("\n", 1);
+		// Failure
+		//else
+		//    CDC_Transmit_FS("\a", 1);
+		(void)result;
+
+		// Move on to next buffer, releasing this one to the ISR only after it was parsed
+		__DMB();
 		rxbuf.tail = (rxbuf.tail + 1) % NUM_RX_BUFS;
 	}
-	system_irq_enable();
 }
 
 
@@ -217,12 +214,15 @@ void cdc_process(void)
  * @param  Len: Number of data to be send (in bytes)
  * @retval Result of the opeartion: USBD_OK if all operations are OK else USBD_FAIL or USBD_BUSY
  */
-
-// TODO: Do some buffering here. Try to transmit 64byte packets.
 uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
 {
+    // Ensure message will fit in buffer
+    if(Len > TX_BUF_SIZE)
+    {
+    	return 0;
+    }
+
     // Attempt to transmit on USB, wait until not busy
-    // Future: implement TX buffering
     uint32_t start_wait = HAL_GetTick();
     while( ((USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData)->TxState)
     {
@@ -234,12 +234,6 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
       }
     }
 
-    // Ensure message will fit in buffer
-    if(Len > TX_BUF_SIZE)
-    {
-    	return 0;
-    }
-
     // Copy data into buffer
     for (uint32_t i=0; i < Len; i++)
     {
@@ -250,3 +244,72 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
     USBD_CDC_SetTxBuffer(&hUsbDeviceFS, txbuf, Len);
     return USBD_CDC_TransmitPacket(&hUsbDeviceFS);
 }
+
+
+// Queue data for batched transmission. The data is queued completely or not at all.
+// Returns Len if queued, 0 if the ring does not have enough free space.
+uint16_t cdc_tx_write(const uint8_t* Buf, uint16_t Len)
+{
+    uint16_t free = (txring_tail + TX_RING_SIZE - txring_head - 1) % TX_RING_SIZE;
+
+    if(Len > free)
+    {
+        return 0;
+    }
+
+    for (uint16_t i=0; i < Len; i++)
+    {
+        txring[txring_head] = Buf[i];
+        txring_head = (txring_head + 1) % TX_RING_SIZE;
+    }
+    return Len;
+}
+
+
+// Queue one byte in the TX ring. Returns 0 if the ring is full.
+uint8_t cdc_tx_putc(uint8_t c)
+{
+    uint16_t next = (txring_head + 1) % TX_RING_SIZE;
+
+    if(next == txring_tail)
+    {
+        return 0;
+    }
+    txring[txring_head] = c;
+    txring_head = next;
+    return 1;
+}
+
+
+// Start the next USB transfer from the TX ring once the previous one has completed.
+// Data is sent straight out of the ring, as many packets per transfer as are contiguous.
+void cdc_tx_process(void)
+{
+    USBD_CDC_HandleTypeDef* hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+
+    if(hcdc == NULL || hcdc->TxState)
+    {
+        return;
+    }
+
+    // Previous transfer from the ring is done, release its bytes
+    txring_tail = (txring_tail + txring_inflight) % TX_RING_SIZE;
+    txring_inflight = 0;
+
+    if(txring_tail == txring_head)
+    {
+        return;
+    }
+
+    uint16_t len = ((txring_head > txring_tail) ? txring_head : TX_RING_SIZE) - txring_tail;
+    if(len > TX_RING_MAX_XFER)
+    {
+        len = TX_RING_MAX_XFER;
+    }
+
+    USBD_CDC_SetTxBuffer(&hUsbDeviceFS, &txring[txring_tail], len);
+    if(USBD_CDC_TransmitPacket(&hUsbDeviceFS) == USBD_OK)
+    {
+        txring_inflight = len;
+    }
+}
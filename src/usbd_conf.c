@@ -53,6 +53,9 @@
 #include "usbd_def.h"
 #include "usbd_core.h"
 #include "usbd_cdc.h"
+#ifdef USB_GSUSB
+#include "usbd_gs_usb.h"
+#endif
 #include "system.h"
 
 /* USER CODE BEGIN Includes */
@@ -311,9 +314,15 @@ USBD_StatusTypeDef USBD_LL_Init(USBD_HandleTypeDef *pdev)
 
   HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x00 , PCD_SNG_BUF, 0x18);
   HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x80 , PCD_SNG_BUF, 0x58);
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x81 , PCD_SNG_BUF, 0xC0);
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x01 , PCD_SNG_BUF, 0x110);
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x82 , PCD_SNG_BUF, 0x100);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x82 , PCD_SNG_BUF, 0x98);
+  // Data endpoints are single-buffered: the class drivers have one transfer per
+  // endpoint in flight, and gs_usb throttles the host by leaving OUT NAKing.
+#ifdef USB_GSUSB
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x02 , PCD_SNG_BUF, 0xC0);
+#else
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x01 , PCD_SNG_BUF, 0xC0);
+#endif
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x81 , PCD_SNG_BUF, 0x100);
   return USBD_OK;
 }
 
@@ -731,8 +740,21 @@ void USBD_LL_Delay(uint32_t Delay)
   */
 void *USBD_static_malloc(uint32_t size)
 {
-  static uint32_t mem[(sizeof(USBD_CDC_HandleTypeDef)/4)+1];/* On 32-bit boundary */
-  return mem;
+  /* Sized for the largest class handle of this build, on 32-bit boundary */
+  static union
+  {
+    uint32_t align;
+    USBD_CDC_HandleTypeDef cdc;
+#ifdef USB_GSUSB
+    gs_usb_handle_t gs_usb;
+#endif
+  } mem;
+
+  if (size > sizeof(mem))
+  {
+    return NULL;
+  }
+  return &mem;
 }
 
 /**
@@ -748,12 +770,12 @@ void USBD_static_free(void *p)
 /* USER CODE BEGIN 5 */
 /**
   * @brief  Configures system clock after wake-up from USB Resume CallBack:
-  *         enable HSI, PLL and select PLL as system clock source.
+  *         only HSI48 is restored, HAL state, SysTick and CRS are kept.
   * @retval None
   */
 static void SystemClockConfig_Resume(void)
 {
-  system_init();
+  system_clock_restore();
 }
 /* USER CODE END 5 */
 
@@ -3,13 +3,23 @@
 #include "usbd_conf.h"
 #include "system.h"
 
-#define USBD_VID			0xad50
 #define USBD_LANGID_STRING		1033
 #define USBD_MANUFACTURER_STRING	"Protofusion Labs"
-#define USBD_PID_FS			0x60c4
 #define USBD_PRODUCT_STRING_FS		"CANable" " " GIT_VERSION " " GIT_REMOTE
+#ifdef USB_GSUSB
+// candleLight IDs: the Linux gs_usb driver binds to these
+#define USBD_VID			0x1d50
+#define USBD_PID_FS			0x606f
+#define USBD_DEVICE_CLASS		0x00
+#define USBD_CONFIGURATION_STRING_FS    "gs_usb Config"
+#define USBD_INTERFACE_STRING_FS	"gs_usb Interface"
+#else
+#define USBD_VID			0xad50
+#define USBD_PID_FS			0x60c4
+#define USBD_DEVICE_CLASS		0x02
 #define USBD_CONFIGURATION_STRING_FS    "CDC Config"
 #define USBD_INTERFACE_STRING_FS	"CDC Interface"
+#endif
 
 
 
@@ -61,8 +71,8 @@ __ALIGN_BEGIN uint8_t USBD_FS_DeviceDesc[USB_LEN_DEV_DESC] __ALIGN_END =
   USB_DESC_TYPE_DEVICE,       /*bDescriptorType*/
   0x00,                       /*bcdUSB */
   0x02,
-  0x02,                       /*bDeviceClass*/
-  0x02,                       /*bDeviceSubClass*/
+  USBD_DEVICE_CLASS,          /*bDeviceClass*/
+  USBD_DEVICE_CLASS,          /*bDeviceSubClass*/
   0x00,                       /*bDeviceProtocol*/
   USB_MAX_EP0_SIZE,           /*bMaxPacketSize*/
   LOBYTE(USBD_VID),           /*idVendor*/
@@ -0,0 +1,431 @@
+//
+// usbd_gs_usb: gs_usb (candleLight) compatible USB class, a binary alternative to USB-CDC
+//
+// Built instead of the CDC class with "make USB_GSUSB=1". Linux binds its
+// gs_usb driver to the device and exposes it as a native SocketCAN interface.
+// Every received frame is sent to the host as one fixed-size gs_host_frame
+// record with a 1 MHz timestamp taken in the CAN RX interrupt, so nothing is
+// formatted on the MCU. Frames sent by the host are queued for transmission
+// and echoed back as TX confirmation.
+//
+
+#include "stm32f0xx_hal.h"
+#include <string.h>
+#include "usbd_gs_usb.h"
+#include "usbd_ctlreq.h"
+#include "can.h"
+
+
+// Private function prototypes
+static uint8_t gs_usb_init(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+static uint8_t gs_usb_deinit(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+static uint8_t gs_usb_setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req);
+static uint8_t gs_usb_ep0_rx_ready(USBD_HandleTypeDef *pdev);
+static uint8_t gs_usb_data_in(USBD_HandleTypeDef *pdev, uint8_t epnum);
+static uint8_t gs_usb_data_out(USBD_HandleTypeDef *pdev, uint8_t epnum);
+static uint8_t *gs_usb_get_cfg_desc(uint16_t *length);
+static uint8_t *gs_usb_get_device_qualifier_desc(uint16_t *length);
+
+
+// Class callbacks
+USBD_ClassTypeDef USBD_GS_USB =
+{
+    gs_usb_init,
+    gs_usb_deinit,
+    gs_usb_setup,
+    NULL, // EP0_TxSent
+    gs_usb_ep0_rx_ready,
+    gs_usb_data_in,
+    gs_usb_data_out,
+    NULL, // SOF
+    NULL,
+    NULL,
+    gs_usb_get_cfg_desc,
+    gs_usb_get_cfg_desc,
+    gs_usb_get_cfg_desc,
+    gs_usb_get_device_qualifier_desc,
+};
+
+// Configuration descriptor: one vendor specific interface with two bulk endpoints
+__ALIGN_BEGIN static uint8_t gs_usb_cfg_desc[GS_USB_CONFIG_DESC_SIZ] __ALIGN_END =
+{
+    0x09, USB_DESC_TYPE_CONFIGURATION, GS_USB_CONFIG_DESC_SIZ, 0x00,
+    0x01, // bNumInterfaces
+    0x01, // bConfigurationValue
+    0x00, // iConfiguration
+    0x80, // bmAttributes: bus powered
+    0x4B, // MaxPower 150 mA
+
+    0x09, USB_DESC_TYPE_INTERFACE,
+    0x00, // bInterfaceNumber
+    0x00, // bAlternateSetting
+    0x02, // bNumEndpoints
+    0xFF, // bInterfaceClass: vendor specific
+    0xFF, // bInterfaceSubClass
+    0xFF, // bInterfaceProtocol
+    0x00, // iInterface
+
+    0x07, USB_DESC_TYPE_ENDPOINT, GS_USB_IN_EP, USBD_EP_TYPE_BULK,
+    LOBYTE(GS_USB_PACKET_SIZE), HIBYTE(GS_USB_PACKET_SIZE), 0x00,
+
+    0x07, USB_DESC_TYPE_ENDPOINT, GS_USB_OUT_EP, USBD_EP_TYPE_BULK,
+    LOBYTE(GS_USB_PACKET_SIZE), HIBYTE(GS_USB_PACKET_SIZE), 0x00,
+};
+
+__ALIGN_BEGIN static uint8_t gs_usb_device_qualifier_desc[USB_LEN_DEV_QUALIFIER_DESC] __ALIGN_END =
+{
+    USB_LEN_DEV_QUALIFIER_DESC, USB_DESC_TYPE_DEVICE_QUALIFIER,
+    0x00, 0x02, 0x00, 0x00, 0x00, 0x40, 0x01, 0x00,
+};
+
+// Bit timing limits reported to the host: the bxCAN ranges (see can.h), so the
+// host picks the sample point like the firmware's own calculator does
+static const uint32_t gs_usb_bt_const[10] =
+{
+    GS_CAN_FEATURE_HW_TIMESTAMP, // feature
+    CAN_CLOCK_HZ, // fclk_can
+    1, CAN_TSEG1_MAX, // tseg1 min / max
+    1, CAN_TSEG2_MAX, // tseg2 min / max
+    CAN_SJW_MAX,      // sjw max
+    1, CAN_BRP_MAX, 1, // brp min / max / increment
+};
+
+// gs_device_config: reserved[3], icount (channels - 1), sw_version, hw_version
+static const uint32_t gs_usb_device_config[3] = { 0, 2, 1 };
+
+extern USBD_HandleTypeDef hUsbDeviceFS;
+
+
+// Open the endpoints and start receiving host frames
+static uint8_t gs_usb_init(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+    USBD_LL_OpenEP(pdev, GS_USB_IN_EP, USBD_EP_TYPE_BULK, GS_USB_PACKET_SIZE);
+    pdev->ep_in[GS_USB_IN_EP & 0xFU].is_used = 1U;
+    USBD_LL_OpenEP(pdev, GS_USB_OUT_EP, USBD_EP_TYPE_BULK, GS_USB_PACKET_SIZE);
+    pdev->ep_out[GS_USB_OUT_EP & 0xFU].is_used = 1U;
+
+    pdev->pClassData = USBD_malloc(sizeof(gs_usb_handle_t));
+    if (pdev->pClassData == NULL)
+    {
+        return USBD_FAIL;
+    }
+
+    gs_usb_handle_t *hgs = (gs_usb_handle_t *)pdev->pClassData;
+    memset(hgs, 0, sizeof(gs_usb_handle_t));
+    hgs->rx_dropped = can_rx_dropped();
+    USBD_LL_PrepareReceive(pdev, GS_USB_OUT_EP, (uint8_t *)&hgs->rx, sizeof(gs_host_frame_t));
+    return USBD_OK;
+}
+
+
+// Close the endpoints; the main loop sees pClassData == NULL and stops streaming
+static uint8_t gs_usb_deinit(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+    USBD_LL_CloseEP(pdev, GS_USB_IN_EP);
+    pdev->ep_in[GS_USB_IN_EP & 0xFU].is_used = 0U;
+    USBD_LL_CloseEP(pdev, GS_USB_OUT_EP);
+    pdev->ep_out[GS_USB_OUT_EP & 0xFU].is_used = 0U;
+
+    if (pdev->pClassData != NULL)
+    {
+        USBD_free(pdev->pClassData);
+        pdev->pClassData = NULL;
+    }
+    return USBD_OK;
+}
+
+
+// Handle the gs_usb vendor requests. Anything touching the CAN peripheral is
+// deferred to gs_usb_process(), this runs in the USB interrupt.
+static uint8_t gs_usb_setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req)
+{
+    static uint16_t status_info = 0U; // Also the alternate setting (always 0)
+    gs_usb_handle_t *hgs = (gs_usb_handle_t *)pdev->pClassData;
+
+    if ((req->bmRequest & USB_REQ_TYPE_MASK) == USB_REQ_TYPE_STANDARD)
+    {
+        if (req->bRequest == USB_REQ_GET_STATUS)
+        {
+            USBD_CtlSendData(pdev, (uint8_t *)&status_info, 2U);
+        }
+        else if (req->bRequest == USB_REQ_GET_INTERFACE)
+        {
+            USBD_CtlSendData(pdev, (uint8_t *)&status_info, 1U);
+        }
+        return USBD_OK;
+    }
+
+    if ((req->bmRequest & USB_REQ_TYPE_MASK) != USB_REQ_TYPE_VENDOR || hgs == NULL)
+    {
+        USBD_CtlError(pdev, req);
+        return USBD_FAIL;
+    }
+
+    switch (req->bRequest)
+    {
+        case GS_USB_BREQ_BT_CONST:
+            USBD_CtlSendData(pdev, (uint8_t *)gs_usb_bt_const, MIN(req->wLength, sizeof(gs_usb_bt_const)));
+            break;
+
+        case GS_USB_BREQ_DEVICE_CONFIG:
+            USBD_CtlSendData(pdev, (uint8_t *)gs_usb_device_config, MIN(req->wLength, sizeof(gs_usb_device_config)));
+            break;
+
+        case GS_USB_BREQ_TIMESTAMP:
+            hgs->ctrl[0] = can_timestamp();
+            USBD_CtlSendData(pdev, (uint8_t *)hgs->ctrl, MIN(req->wLength, 4));
+            break;
+
+        case GS_USB_BREQ_HOST_FORMAT:
+        case GS_USB_BREQ_BITTIMING:
+        case GS_USB_BREQ_MODE:
+        case GS_USB_BREQ_BERR:
+        case GS_USB_BREQ_IDENTIFY:
+            if (req->wLength > sizeof(hgs->ctrl))
+            {
+                USBD_CtlError(pdev, req);
+                return USBD_FAIL;
+            }
+            if (req->wLength)
+            {
+                hgs->ctrl_req = req->bRequest;
+                USBD_CtlPrepareRx(pdev, (uint8_t *)hgs->ctrl, req->wLength);
+            }
+            break;
+
+        default:
+            USBD_CtlError(pdev, req);
+            return USBD_FAIL;
+    }
+    return USBD_OK;
+}
+
+
+// Data stage of a host-to-device vendor request has been received
+static uint8_t gs_usb_ep0_rx_ready(USBD_HandleTypeDef *pdev)
+{
+    gs_usb_handle_t *hgs = (gs_usb_handle_t *)pdev->pClassData;
+
+    switch (hgs->ctrl_req)
+    {
+        case GS_USB_BREQ_BITTIMING:
+            memcpy(hgs->bt, hgs->ctrl, sizeof(hgs->bt));
+            hgs->bt_pending = 1;
+            break;
+
+        case GS_USB_BREQ_MODE:
+            hgs->mode = hgs->ctrl[0];
+            hgs->flags = hgs->ctrl[1];
+            hgs->mode_pending = 1;
+            break;
+
+        default: // HOST_FORMAT (always little endian here), BERR, IDENTIFY
+            break;
+    }
+    hgs->ctrl_req = 0xFF;
+    return USBD_OK;
+}
+
+
+// IN transfer finished: release the queue slot
+static uint8_t gs_usb_data_in(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+    gs_usb_handle_t *hgs = (gs_usb_handle_t *)pdev->pClassData;
+
+    if (hgs != NULL)
+    {
+        hgs->tail = (hgs->tail + 1) % GS_USB_QUEUE_LEN;
+        hgs->in_busy = 0;
+    }
+    return USBD_OK;
+}
+
+
+// Host frame received: the endpoint stays NAKed until the main loop took it
+static uint8_t gs_usb_data_out(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+    gs_usb_handle_t *hgs = (gs_usb_handle_t *)pdev->pClassData;
+
+    if (hgs != NULL)
+    {
+        hgs->rx_pending = 1;
+    }
+    return USBD_OK;
+}
+
+
+static uint8_t *gs_usb_get_cfg_desc(uint16_t *length)
+{
+    *length = sizeof(gs_usb_cfg_desc);
+    return gs_usb_cfg_desc;
+}
+
+
+static uint8_t *gs_usb_get_device_qualifier_desc(uint16_t *length)
+{
+    *length = sizeof(gs_usb_device_qualifier_desc);
+    return gs_usb_device_qualifier_desc;
+}
+
+
+// Claim the next free slot of the IN queue, NULL if it is full
+static gs_host_frame_t *gs_usb_queue_slot(gs_usb_handle_t *hgs)
+{
+    if ((hgs->head + 1) % GS_USB_QUEUE_LEN == hgs->tail)
+    {
+        return NULL;
+    }
+    return &hgs->queue[hgs->head];
+}
+
+
+// Publish the slot returned by gs_usb_queue_slot()
+static void gs_usb_queue_push(gs_usb_handle_t *hgs)
+{
+    __DMB();
+    hgs->head = (hgs->head + 1) % GS_USB_QUEUE_LEN;
+}
+
+
+// Queue a received CAN frame for the host (call from the main loop for every frame)
+void gs_usb_frame(const CAN_RxHeaderTypeDef *rx_msg_header, const uint8_t *rx_msg_data)
+{
+    gs_usb_handle_t *hgs = (gs_usb_handle_t *)hUsbDeviceFS.pClassData;
+
+    if (hgs == NULL || !hgs->started)
+    {
+        return;
+    }
+
+    gs_host_frame_t *frame = gs_usb_queue_slot(hgs);
+    if (frame == NULL)
+    {
+        // Reported to the host with the overflow flag of the next frame
+        hgs->overflow = 1;
+        return;
+    }
+
+    frame->echo_id = GS_HOST_FRAME_ECHO_RX;
+    if (rx_msg_header->IDE == CAN_ID_EXT)
+    {
+        frame->can_id = rx_msg_header->ExtId | GS_CAN_EFF_FLAG;
+    }
+    else
+    {
+        frame->can_id = rx_msg_header->StdId;
+    }
+    if (rx_msg_header->RTR != CAN_RTR_DATA)
+    {
+        frame->can_id |= GS_CAN_RTR_FLAG;
+    }
+    frame->can_dlc = rx_msg_header->DLC;
+    frame->channel = 0;
+    frame->flags = 0;
+    frame->reserved = 0;
+    memcpy(frame->data, rx_msg_data, 8);
+    frame->timestamp_us = rx_msg_header->Timestamp;
+
+    // Frames lost in the CAN RX ring or in this queue since the last report
+    uint32_t dropped = can_rx_dropped();
+    if (dropped != hgs->rx_dropped || hgs->overflow)
+    {
+        frame->flags |= GS_CAN_FLAG_OVERFLOW;
+        hgs->rx_dropped = dropped;
+        hgs->overflow = 0;
+    }
+
+    gs_usb_queue_push(hgs);
+}
+
+
+// Apply the bit timing received from the host. The fields are uint32 on the wire:
+// range check them before they are narrowed, can_set_bittiming() checks the rest.
+static int8_t gs_usb_set_bittiming(const gs_usb_handle_t *hgs)
+{
+    if (hgs->bt[0] > CAN_TSEG1_MAX || hgs->bt[1] > CAN_TSEG1_MAX ||
+        hgs->bt[2] > CAN_TSEG2_MAX || hgs->bt[3] > CAN_SJW_MAX)
+    {
+        return -1;
+    }
+    return can_set_bittiming(hgs->bt[4], hgs->bt[0] + hgs->bt[1], hgs->bt[2], hgs->bt[3]);
+}
+
+
+// Apply mode changes, forward host frames to the CAN bus and feed the IN endpoint
+void gs_usb_process(void)
+{
+    gs_usb_handle_t *hgs = (gs_usb_handle_t *)hUsbDeviceFS.pClassData;
+
+    if (hgs == NULL)
+    {
+        return;
+    }
+
+    if (hgs->mode_pending)
+    {
+        hgs->mode_pending = 0;
+        hgs->started = (hgs->mode == GS_CAN_MODE_START);
+
+        // Restart the peripheral only if the host sent a bit timing. The status
+        // stage of the request has already been acknowledged, so an invalid one
+        // keeps the interface stopped (the bus keeps the previous bit timing).
+        if (hgs->started && hgs->bt_pending)
+        {
+            can_disable();
+            if (gs_usb_set_bittiming(hgs) == 0)
+            {
+                hgs->bt_pending = 0;
+            }
+            else
+            {
+                hgs->started = 0;
+            }
+            can_enable();
+        }
+        can_set_accept_all(hgs->started);
+    }
+
+    // Host frame: transmit it and queue the echo as TX confirmation. While the
+    // CAN TX queue or the IN queue is full the frame stays pending and the OUT
+    // endpoint keeps NAKing, which throttles the host.
+    if (hgs->rx_pending)
+    {
+        gs_host_frame_t *echo = gs_usb_queue_slot(hgs);
+        if (echo != NULL)
+        {
+            CAN_TxHeaderTypeDef tx_msg_header;
+            uint32_t can_id = hgs->rx.can_id;
+
+            tx_msg_header.IDE = (can_id & GS_CAN_EFF_FLAG) ? CAN_ID_EXT : CAN_ID_STD;
+            tx_msg_header.StdId = can_id & 0x7FF;
+            tx_msg_header.ExtId = can_id & 0x1FFFFFFF;
+            tx_msg_header.RTR = (can_id & GS_CAN_RTR_FLAG) ? CAN_RTR_REMOTE : CAN_RTR_DATA;
+            tx_msg_header.DLC = (hgs->rx.can_dlc > 8) ? 8 : hgs->rx.can_dlc;
+            tx_msg_header.TransmitGlobalTime = DISABLE;
+
+            if (!hgs->started || can_tx(&tx_msg_header, hgs->rx.data) == HAL_OK)
+            {
+                if (hgs->started)
+                {
+                    *echo = hgs->rx;
+                    echo->timestamp_us = can_timestamp();
+                    gs_usb_queue_push(hgs);
+                }
+                hgs->rx_pending = 0;
+                USBD_LL_PrepareReceive(&hUsbDeviceFS, GS_USB_OUT_EP, (uint8_t *)&hgs->rx, sizeof(gs_host_frame_t));
+            }
+        }
+    }
+    can_process();
+
+    if (!hgs->in_busy && hgs->tail != hgs->head)
+    {
+        uint16_t len = sizeof(gs_host_frame_t);
+        if (!(hgs->flags & GS_CAN_FEATURE_HW_TIMESTAMP))
+        {
+            len -= sizeof(uint32_t);
+        }
+        hgs->in_busy = 1;
+        USBD_LL_Transmit(&hUsbDeviceFS, GS_USB_IN_EP, (uint8_t *)&hgs->queue[hgs->tail], len);
+    }
+}
@@ -0,0 +1,149 @@
+//
+// bench_queues: host throughput of the hot path queues under simulated
+// interrupt interleavings
+//
+// The producer side of each queue runs in bursts at pseudo random points of
+// the consumer loop, like the CAN and USB interrupts preempt the main loop.
+// Times are host nanoseconds per item: only useful relative to an earlier run
+// on the same machine, to catch a regression before flashing.
+//
+
+#include <stdio.h>
+#include <time.h>
+#include "test.h"
+#include "can.h"
+#include "error.h"
+#include "subaru_levorg_vnx.h"
+
+
+#define BENCH_ITEMS 1000000
+
+
+// Monotonic time in ns
+static uint64_t bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void bench_report(const char *name, uint64_t start, uint32_t items, uint32_t dropped)
+{
+    uint64_t elapsed = bench_now() - start;
+
+    printf("bench %-8s %8u items %7.1f ns/item %6u dropped\n", name, items, (double)elapsed / items, dropped);
+}
+
+
+// can_tx() / can_process(), mailboxes freed in random bursts (TX complete)
+static void bench_can_tx(void)
+{
+    CAN_TxHeaderTypeDef header = { .StdId = CAN_ID_SPEED, .IDE = CAN_ID_STD, .RTR = CAN_RTR_DATA, .DLC = 8 };
+    uint8_t data[8] = { 0 };
+    uint32_t queued = 0;
+    uint32_t dropped = 0;
+
+    test_reset();
+    uint64_t start = bench_now();
+    while(queued + dropped < BENCH_ITEMS){
+        uint8_t burst = fake_random() % 3;
+
+        for(uint8_t i = 0; i < burst; i++){
+            data[0] = queued;
+            if(can_tx(&header, data) == HAL_OK)
+                queued++;
+            else
+                dropped++;
+        }
+        if(fake_random() % 2)
+            fake_can_free = 3;
+        can_process();
+    }
+    bench_report("can_tx", start, queued, dropped);
+}
+
+
+// RX interrupt into the ring / can_rx(), interrupts in random bursts
+static void bench_can_rx(void)
+{
+    CAN_RxHeaderTypeDef header;
+    uint8_t data[8] = { 0 };
+    uint32_t received = 0;
+
+    test_reset();
+    can_enable();
+    uint64_t start = bench_now();
+    for(uint32_t produced = 0; produced < BENCH_ITEMS; ){
+        uint8_t burst = fake_random() % 8;
+        uint8_t reads = fake_random() % 9;
+
+        for(uint8_t i = 0; i < burst; i++, produced++)
+            fake_can_frame(CAN_ID_SPEED, 0, 0, 8, data);
+        for(uint8_t i = 0; i < reads && can_rx(&header, data) == HAL_OK; i++)
+            received++;
+    }
+    bench_report("can_rx", start, received, can_rx_dropped());
+}
+
+
+// USB OUT packets into the RX FIFO / cdc_process(), packets in random bursts
+static void bench_cdc_rx(void)
+{
+    uint8_t packet[RX_BUF_SIZE] = { 0 };
+    uint32_t parsed = 0;
+    uint32_t refused = 0;
+
+    test_reset();
+    uint64_t start = bench_now();
+    for(uint32_t produced = 0; produced < BENCH_ITEMS; ){
+        uint8_t burst = fake_random() % 4;
+        uint8_t passes = fake_random() % 5;
+
+        for(uint8_t i = 0; i < burst; i++, produced++){
+            if(fake_usb_packet(packet, sizeof(packet)) != USBD_OK)
+                refused++;
+        }
+        for(uint8_t i = 0; i < passes && cdc_rx_pending(); i++, parsed++)
+            cdc_process();
+    }
+    bench_report("cdc_rx", start, parsed, refused);
+}
+
+
+// cdc_tx_putc() / cdc_tx_process(), transfers complete at random points
+static void bench_cdc_tx(void)
+{
+    uint32_t queued = 0;
+    uint32_t refused = 0;
+
+    test_reset();
+    fake_usb_busy = 1;
+    uint64_t start = bench_now();
+    while(queued + refused < BENCH_ITEMS){
+        uint8_t burst = fake_random() % 64;
+
+        for(uint8_t i = 0; i < burst; i++){
+            if(cdc_tx_putc(i))
+                queued++;
+            else
+                refused++;
+        }
+        if(fake_random() % 2){
+            fake_cdc.TxState = 0;
+            fake_usb_out_len = 0;
+        }
+        cdc_tx_process();
+    }
+    bench_report("cdc_tx", start, queued, refused);
+}
+
+
+void bench_queues(void)
+{
+    bench_can_tx();
+    bench_can_rx();
+    bench_cdc_rx();
+    bench_cdc_tx();
+}
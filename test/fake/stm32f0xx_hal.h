@@ -0,0 +1,32 @@
+#ifndef _FAKE_STM32F0XX_HAL_H
+#define _FAKE_STM32F0XX_HAL_H
+
+//
+// Host build (make test): the real HAL and CMSIS headers provide the types and
+// register bit definitions, the peripherals used directly by the firmware are
+// redirected to plain structs in RAM (test/fake_hal.c).
+//
+
+#include_next "stm32f0xx_hal.h"
+
+extern CAN_TypeDef fake_can;
+extern TIM_TypeDef fake_tim2;
+extern RCC_TypeDef fake_rcc;
+extern SysTick_Type fake_systick;
+extern SCB_Type fake_scb;
+
+#undef CAN
+#define CAN (&fake_can)
+#undef TIM2
+#define TIM2 (&fake_tim2)
+#undef RCC
+#define RCC (&fake_rcc)
+#undef SysTick
+#define SysTick (&fake_systick)
+#undef SCB
+#define SCB (&fake_scb)
+
+// No ARM barrier instruction on the host, a compiler and CPU fence instead
+#define __DMB() __sync_synchronize()
+
+#endif // _FAKE_STM32F0XX_HAL_H
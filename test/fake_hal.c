@@ -0,0 +1,303 @@
+//
+// fake_hal: host stand-ins for the HAL, the USB device library and the
+// peripherals the firmware modules under test touch
+//
+// Register blocks are plain structs. The RX FIFO of the bxCAN is modelled by
+// fake_can_frame(), which loads mailbox 0 and runs the CAN RX interrupt
+// handler; writing RFOM0 to RF0R clears FMP0, so the handler takes exactly one
+// frame per call. TX mailboxes are a counter, USB transfers are appended to
+// fake_usb_out and complete at once unless fake_usb_busy is set.
+//
+
+#include <string.h>
+#include "test.h"
+#include "can.h"
+#include "usbd_cdc_if.h"
+#include "avhcontroller.h"
+#include "system.h"
+
+
+// Peripherals
+CAN_TypeDef fake_can;
+TIM_TypeDef fake_tim2;
+RCC_TypeDef fake_rcc;
+SysTick_Type fake_systick;
+SCB_Type fake_scb;
+
+// HAL state
+uint32_t fake_tick = 0;
+uint32_t fake_tick_step = 0;
+uint32_t fake_can_free = 3;
+HAL_StatusTypeDef fake_can_add_status = HAL_OK;
+uint32_t fake_can_sent = 0;
+CAN_TxHeaderTypeDef fake_can_last_header;
+uint8_t fake_can_last_data[8];
+
+// USB device state
+USBD_CDC_HandleTypeDef fake_cdc;
+USBD_HandleTypeDef hUsbDeviceFS = { .pClassData = &fake_cdc };
+uint8_t fake_usb_out[4096];
+uint32_t fake_usb_out_len = 0;
+uint32_t fake_usb_transfers = 0;
+uint8_t fake_usb_busy = 0;
+uint8_t *fake_usb_rx_buf = NULL;
+uint32_t fake_usb_rx_armed = 0;
+static uint8_t *usb_tx_buf = NULL;
+static uint32_t usb_tx_len = 0;
+
+// system.c
+uint32_t fake_system_init_calls = 0;
+uint32_t fake_clock_restores = 0;
+
+// Command parser
+uint8_t fake_parse_buf[512];
+uint32_t fake_parse_len = 0;
+uint32_t fake_parse_calls = 0;
+
+static uint32_t random_state = 1;
+
+
+// Back to power-on state (the module state is reset by the test_*_reset() functions)
+void fake_reset(void)
+{
+    memset(&fake_can, 0, sizeof(fake_can));
+    memset(&fake_tim2, 0, sizeof(fake_tim2));
+    memset(&fake_systick, 0, sizeof(fake_systick));
+    memset(&fake_scb, 0, sizeof(fake_scb));
+    fake_systick.LOAD = 47999;
+    fake_tick = 0;
+    fake_tick_step = 0;
+    fake_can_free = 3;
+    fake_can_add_status = HAL_OK;
+    fake_can_sent = 0;
+    memset(&fake_cdc, 0, sizeof(fake_cdc));
+    fake_usb_out_len = 0;
+    fake_usb_transfers = 0;
+    fake_usb_busy = 0;
+    fake_usb_rx_armed = 0;
+    fake_parse_len = 0;
+    fake_parse_calls = 0;
+    fake_system_init_calls = 0;
+    fake_clock_restores = 0;
+    random_state = 1;
+}
+
+
+// Receive a frame: load RX FIFO0 mailbox 0 and run the CAN interrupt
+void fake_can_frame(uint32_t id, uint8_t ext, uint8_t rtr, uint8_t dlc, const uint8_t *data)
+{
+    uint32_t rir = ext ? (id << CAN_RI0R_EXID_Pos) | CAN_RI0R_IDE : id << CAN_RI0R_STID_Pos;
+
+    fake_can.sFIFOMailBox[0].RIR = rir | (rtr ? CAN_RI0R_RTR : 0);
+    fake_can.sFIFOMailBox[0].RDTR = dlc;
+    fake_can.sFIFOMailBox[0].RDLR = data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+    fake_can.sFIFOMailBox[0].RDHR = data[4] | data[5] << 8 | data[6] << 16 | (uint32_t)data[7] << 24;
+    fake_can.RF0R = 1; // FMP0: one message pending
+    can_rx_isr();
+}
+
+
+// Receive a USB OUT packet into the buffer the CDC interface armed, and run its callback
+int8_t fake_usb_packet(const uint8_t *data, uint32_t len)
+{
+    memcpy(fake_usb_rx_buf, data, len);
+    return USBD_Interface_fops_FS.Receive(fake_usb_rx_buf, &len);
+}
+
+
+// Deterministic pseudo random numbers (xorshift32), reset by fake_reset()
+uint32_t fake_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+
+// HAL
+uint32_t HAL_GetTick(void)
+{
+    uint32_t tick = fake_tick;
+    fake_tick += fake_tick_step;
+    return tick;
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+    fake_tick += Delay;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void)
+{
+    return 48000000;
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init) {}
+void HAL_GPIO_DeInit(GPIO_TypeDef *GPIOx, uint32_t GPIO_Pin) {}
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority) {}
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn) {}
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn) {}
+
+HAL_StatusTypeDef HAL_CAN_Init(CAN_HandleTypeDef *hcan)
+{
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_ConfigFilter(CAN_HandleTypeDef *hcan, CAN_FilterTypeDef *sFilterConfig)
+{
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_Start(CAN_HandleTypeDef *hcan)
+{
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_ActivateNotification(CAN_HandleTypeDef *hcan, uint32_t ActiveITs)
+{
+    hcan->Instance->IER |= ActiveITs;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_RequestSleep(CAN_HandleTypeDef *hcan)
+{
+    return HAL_OK;
+}
+
+uint32_t HAL_CAN_IsSleepActive(CAN_HandleTypeDef *hcan)
+{
+    return 1;
+}
+
+HAL_StatusTypeDef HAL_CAN_WakeUp(CAN_HandleTypeDef *hcan)
+{
+    return HAL_OK;
+}
+
+uint32_t HAL_CAN_GetTxMailboxesFreeLevel(CAN_HandleTypeDef *hcan)
+{
+    return fake_can_free;
+}
+
+HAL_StatusTypeDef HAL_CAN_AddTxMessage(CAN_HandleTypeDef *hcan, CAN_TxHeaderTypeDef *pHeader, uint8_t aData[], uint32_t *pTxMailbox)
+{
+    if(fake_can_add_status != HAL_OK)
+        return fake_can_add_status;
+
+    fake_can_free--;
+    fake_can_sent++;
+    fake_can_last_header = *pHeader;
+    memcpy(fake_can_last_data, aData, sizeof(fake_can_last_data));
+    *pTxMailbox = CAN_TX_MAILBOX0;
+    return HAL_OK;
+}
+
+
+// system.c
+void system_init(void)
+{
+    fake_system_init_calls++;
+}
+
+void system_clock_restore(void)
+{
+    fake_clock_restores++;
+}
+
+void system_irq_disable(void) {}
+void system_irq_enable(void) {}
+
+
+// USB device library
+uint8_t USBD_CDC_SetTxBuffer(USBD_HandleTypeDef *pdev, uint8_t *pbuff, uint16_t length)
+{
+    usb_tx_buf = pbuff;
+    usb_tx_len = length;
+    return USBD_OK;
+}
+
+uint8_t USBD_CDC_SetRxBuffer(USBD_HandleTypeDef *pdev, uint8_t *pbuff)
+{
+    fake_usb_rx_buf = pbuff;
+    return USBD_OK;
+}
+
+uint8_t USBD_CDC_ReceivePacket(USBD_HandleTypeDef *pdev)
+{
+    fake_usb_rx_armed++;
+    return USBD_OK;
+}
+
+uint8_t USBD_CDC_TransmitPacket(USBD_HandleTypeDef *pdev)
+{
+    if(fake_cdc.TxState)
+        return USBD_BUSY;
+
+    if(fake_usb_out_len + usb_tx_len <= sizeof(fake_usb_out)){
+        memcpy(&fake_usb_out[fake_usb_out_len], usb_tx_buf, usb_tx_len);
+        fake_usb_out_len += usb_tx_len;
+    }
+    fake_usb_transfers++;
+    fake_cdc.TxState = fake_usb_busy;
+    return USBD_OK;
+}
+
+
+// USB device core: only the suspend state is modelled
+USBD_StatusTypeDef USBD_LL_Suspend(USBD_HandleTypeDef *pdev)
+{
+    pdev->dev_old_state = pdev->dev_state;
+    pdev->dev_state = USBD_STATE_SUSPENDED;
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_Resume(USBD_HandleTypeDef *pdev)
+{
+    if(pdev->dev_state == USBD_STATE_SUSPENDED)
+        pdev->dev_state = pdev->dev_old_state;
+    return USBD_OK;
+}
+
+USBD_StatusTypeDef USBD_LL_SetupStage(USBD_HandleTypeDef *pdev, uint8_t *psetup) { return USBD_OK; }
+USBD_StatusTypeDef USBD_LL_DataOutStage(USBD_HandleTypeDef *pdev, uint8_t epnum, uint8_t *pdata) { return USBD_OK; }
+USBD_StatusTypeDef USBD_LL_DataInStage(USBD_HandleTypeDef *pdev, uint8_t epnum, uint8_t *pdata) { return USBD_OK; }
+USBD_StatusTypeDef USBD_LL_Reset(USBD_HandleTypeDef *pdev) { return USBD_OK; }
+USBD_StatusTypeDef USBD_LL_SetSpeed(USBD_HandleTypeDef *pdev, USBD_SpeedTypeDef speed) { return USBD_OK; }
+USBD_StatusTypeDef USBD_LL_SOF(USBD_HandleTypeDef *pdev) { return USBD_OK; }
+USBD_StatusTypeDef USBD_LL_IsoINIncomplete(USBD_HandleTypeDef *pdev, uint8_t epnum) { return USBD_OK; }
+USBD_StatusTypeDef USBD_LL_IsoOUTIncomplete(USBD_HandleTypeDef *pdev, uint8_t epnum) { return USBD_OK; }
+USBD_StatusTypeDef USBD_LL_DevConnected(USBD_HandleTypeDef *pdev) { return USBD_OK; }
+USBD_StatusTypeDef USBD_LL_DevDisconnected(USBD_HandleTypeDef *pdev) { return USBD_OK; }
+
+
+// USB PCD driver
+HAL_StatusTypeDef HAL_PCD_Init(PCD_HandleTypeDef *hpcd) { return HAL_OK; }
+HAL_StatusTypeDef HAL_PCD_DeInit(PCD_HandleTypeDef *hpcd) { return HAL_OK; }
+HAL_StatusTypeDef HAL_PCD_Start(PCD_HandleTypeDef *hpcd) { return HAL_OK; }
+HAL_StatusTypeDef HAL_PCD_Stop(PCD_HandleTypeDef *hpcd) { return HAL_OK; }
+HAL_StatusTypeDef HAL_PCD_SetAddress(PCD_HandleTypeDef *hpcd, uint8_t address) { return HAL_OK; }
+HAL_StatusTypeDef HAL_PCD_EP_Open(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint16_t ep_mps, uint8_t ep_type) { return HAL_OK; }
+HAL_StatusTypeDef HAL_PCD_EP_Close(PCD_HandleTypeDef *hpcd, uint8_t ep_addr) { return HAL_OK; }
+HAL_StatusTypeDef HAL_PCD_EP_Flush(PCD_HandleTypeDef *hpcd, uint8_t ep_addr) { return HAL_OK; }
+HAL_StatusTypeDef HAL_PCD_EP_SetStall(PCD_HandleTypeDef *hpcd, uint8_t ep_addr) { return HAL_OK; }
+HAL_StatusTypeDef HAL_PCD_EP_ClrStall(PCD_HandleTypeDef *hpcd, uint8_t ep_addr) { return HAL_OK; }
+HAL_StatusTypeDef HAL_PCD_EP_Transmit(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint8_t *pBuf, uint32_t len) { return HAL_OK; }
+HAL_StatusTypeDef HAL_PCD_EP_Receive(PCD_HandleTypeDef *hpcd, uint8_t ep_addr, uint8_t *pBuf, uint32_t len) { return HAL_OK; }
+uint32_t HAL_PCD_EP_GetRxCount(PCD_HandleTypeDef *hpcd, uint8_t ep_addr) { return 0; }
+HAL_StatusTypeDef HAL_PCDEx_PMAConfig(PCD_HandleTypeDef *hpcd, uint16_t ep_addr, uint16_t ep_kind, uint32_t pmaadress) { return HAL_OK; }
+
+// avhcontroller.c
+int8_t avhcontroller_parse(const uint8_t *buf, uint32_t len)
+{
+    if(fake_parse_len + len <= sizeof(fake_parse_buf)){
+        memcpy(&fake_parse_buf[fake_parse_len], buf, len);
+        fake_parse_len += len;
+    }
+    fake_parse_calls++;
+    return 0;
+}
+
+
+// printf.c (printf_ itself goes to the USB TX ring)
+void _putchar(char character) {}
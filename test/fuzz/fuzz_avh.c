@@ -0,0 +1,324 @@
+//
+// fuzz_avh: coverage guided fuzzing of the AVH decision logic (avh.c)
+//
+// The input is a sequence of received frames, FUZZ_RECORD bytes each:
+//
+//   0     ID selector: the VN5 IDs avh.c decodes, or (values >= 8) an unknown ID
+//   1     flags: bit 0 remote frame, bit 1 error passive, bit 2 the frame is
+//         received while avh.c waits in supervisor_delay(), bits 4..7 DLC xor 8
+//   2..9  data
+//   10    time since the previous frame (ms)
+//
+// A leading byte selects the MAX_RETRY calibration (1..15). The frames run
+// through avh_process() like in the main loop, with the CAN driver, the retry
+// delay and the other modules stubbed. Invariants, checked after every frame and on
+// every transmitted control frame:
+//
+//   - AVH is never introduced (control frame bit 1) while the vehicle moves
+//   - at most 2 * MAX_RETRY control frames per episode: a run of requests in
+//     the same direction, until the AVH status changes, the control restarts
+//     or the engine stops
+//   - bounded work per frame: at most 2 control frames and 2 waits of RETRY_DELAY
+//   - the state CRC is sealed
+//
+// Built with libFuzzer (make fuzz) or as a standalone program that replays
+// files and then random inputs (make fuzz-smoke, also the AFL entry point).
+// The standalone program first checks when avh_init() takes the state over.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../src/avh.c"
+
+
+#define FUZZ_RECORD 11
+#define FUZZ_PENDING 0x04
+
+
+// Stubbed peripherals and modules
+RCC_TypeDef fake_rcc;
+calib_t calib;
+
+// Harness state
+static const uint8_t *input;
+static size_t input_len;
+static uint32_t tick;
+static uint8_t passive;
+static uint8_t in_delay;
+static uint32_t frame_tx;       // Control frames sent while processing the current frame
+static uint32_t frame_delays;   // supervisor_delay() calls while processing the current frame
+static uint32_t episode_tx;     // Control frames sent in the current episode
+static int8_t episode_dir;      // Direction of the current episode (-1: none)
+static uint32_t warm_logged;    // EVT_WARM_RESTART records
+static uint32_t supervisor_starts;
+
+
+// Abort with the invariant that failed, so the fuzzer keeps the input
+#define INVARIANT(cond) do { if(!(cond)){ \
+        fprintf(stderr, "invariant failed: %s (%s:%d)\n", #cond, __FILE__, __LINE__); abort(); } } while(0)
+
+
+// Decode the next record into a frame. Returns 0 at the end of the input.
+static uint8_t next_frame(CAN_RxHeaderTypeDef *header, uint8_t *data, uint8_t *flags)
+{
+    static const uint16_t ids[] = {
+        CAN_ID_ACCEL, CAN_ID_SHIFT, CAN_ID_SPEED, CAN_ID_EYESIGHT,
+        CAN_ID_AVH_STATUS, CAN_ID_BELT, CAN_ID_DOOR, CAN_ID_AVH_CONTROL,
+    };
+
+    if(input_len < FUZZ_RECORD)
+        return 0;
+
+    *flags = input[1];
+    header->StdId = input[0] < 8 ? ids[input[0]] : input[0] << 3 | input[10] >> 5;
+    header->ExtId = 0;
+    header->IDE = CAN_ID_STD;
+    header->RTR = (*flags & 0x01) ? CAN_RTR_REMOTE : CAN_RTR_DATA;
+    header->DLC = (*flags >> 4) ^ 8;
+    header->Timestamp = tick;
+    memcpy(data, &input[2], 8);
+    tick += input[10];
+
+    input += FUZZ_RECORD;
+    input_len -= FUZZ_RECORD;
+    return 1;
+}
+
+
+// CAN driver: transmitted control frames are checked, frames flagged as arriving
+// during supervisor_delay() are what avh.c finds pending afterwards
+uint32_t can_tx(CAN_TxHeaderTypeDef *tx_msg_header, uint8_t *tx_msg_data)
+{
+    int8_t dir = (tx_msg_data[2] & 0x02) ? 1 : 0;
+
+    INVARIANT(tx_msg_header->StdId == CAN_ID_AVH_CONTROL && tx_msg_header->DLC == 8);
+    INVARIANT((tx_msg_data[2] & 0x03) == 0x01 || (tx_msg_data[2] & 0x03) == 0x02);
+    INVARIANT(!dir || state.VnxParam.Speed == 0.0);
+
+    if(dir != episode_dir){
+        episode_dir = dir;
+        episode_tx = 0;
+    }
+    episode_tx++;
+    frame_tx++;
+    INVARIANT(episode_tx <= 2 * MAX_RETRY);
+    INVARIANT(frame_tx <= 2);
+    return HAL_OK;
+}
+
+void can_process(void) {}
+
+uint8_t is_can_msg_pending(uint8_t fifo)
+{
+    return in_delay && input_len >= FUZZ_RECORD && (input[1] & FUZZ_PENDING);
+}
+
+uint32_t can_rx(CAN_RxHeaderTypeDef *rx_msg_header, uint8_t *rx_msg_data)
+{
+    uint8_t flags;
+
+    return next_frame(rx_msg_header, rx_msg_data, &flags) ? HAL_OK : HAL_ERROR;
+}
+
+
+// HAL
+uint32_t HAL_GetTick(void)
+{
+    return tick;
+}
+
+
+// Other modules
+uint8_t error_can_passive(void)
+{
+    return passive;
+}
+
+uint32_t system_crc32(const void *data, uint32_t len)
+{
+    const uint8_t *p = data;
+    uint32_t crc = 0xFFFFFFFF;
+
+    while (len--) {
+        crc ^= *p++;
+        for (uint8_t i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+int printf_(const char *format, ...)
+{
+    return 0;
+}
+
+void journal_log(uint8_t event, uint8_t a, uint8_t b)
+{
+    if(event == EVT_WARM_RESTART)
+        warm_logged++;
+}
+
+void supervisor_start(void)
+{
+    supervisor_starts++;
+}
+
+void supervisor_delay(uint32_t ms)
+{
+    tick += ms;
+    in_delay = 1;
+    frame_delays++;
+    INVARIANT(frame_delays <= 2);
+}
+
+void led_orange_on(void) {}
+void led_orange_off(void) {}
+void led_green_on(void) {}
+void led_green_off(void) {}
+
+
+// One input: power-on state, then every frame through avh_process()
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    CAN_RxHeaderTypeDef header;
+    uint8_t frame[8];
+    uint8_t flags;
+
+    if(size < 1)
+        return 0;
+
+    calib.brake_high = BRAKE_HIGH_DEFAULT;
+    calib.brake_low = BRAKE_LOW_DEFAULT;
+    calib.max_retry = data[0] % 15 + 1;
+    calib.retry_delay = RETRY_DELAY_DEFAULT;
+    calib.sum_check_adder = SUM_CHECK_ADDER_DEFAULT;
+    input = data + 1;
+    input_len = size - 1;
+    tick = 0;
+    episode_tx = 0;
+    episode_dir = -1;
+    PassiveTxTick = 0;
+    avh_reset();
+    avh_seal();
+
+    while(next_frame(&header, frame, &flags)){
+        uint8_t prev_status = state.VnxParam.AvhStatus & 0b01;
+        enum prog_status prev_prog = state.ProgStatus;
+
+        passive = (flags & 0x02) != 0;
+        in_delay = 0;
+        frame_tx = 0;
+        frame_delays = 0;
+        avh_process(&header, frame);
+
+        // A new episode: the car reacted, the control restarted or the engine stopped
+        if((state.VnxParam.AvhStatus & 0b01) != prev_status ||
+           (state.ProgStatus == PROCESSING && prev_prog != PROCESSING) || state.AvhControlStatus == ENGINE_STOP){
+            episode_tx = 0;
+            episode_dir = -1;
+        }
+
+        INVARIANT(state.AvhControl == AVH_OFF || state.AvhControl == AVH_ON);
+        INVARIANT(state.Retry <= MAX_RETRY);
+        INVARIANT(state.crc == system_crc32(&state, offsetof(avh_state_t, crc)));
+    }
+    return 0;
+}
+
+
+#ifdef FUZZ_STANDALONE
+// Without libFuzzer: replay the files given on the command line (crash
+// reproducers, AFL), or run FUZZ_ITERATIONS random inputs
+#define FUZZ_ITERATIONS 200000
+
+
+// Reset with a preserved state that is distinct from a fresh one (moving, AVH
+// requested), then run avh_init(). Returns 1 if the state was taken over.
+static uint8_t takeover(uint32_t csr, uint32_t crc_error, enum avh_control_status status)
+{
+    uint32_t logged = warm_logged;
+    uint32_t starts = supervisor_starts;
+
+    state.AvhControlStatus = status;
+    state.AvhControl = AVH_ON;
+    state.PrevSpeed = 42;
+    avh_seal();
+    state.crc ^= crc_error;
+
+    fake_rcc.CSR = csr;
+    avh_init();
+
+    INVARIANT(state.crc == system_crc32(&state, offsetof(avh_state_t, crc)));
+    if(state.PrevSpeed != 42){
+        INVARIANT(state.AvhControlStatus == ENGINE_STOP && state.AvhControl == AVH_OFF);
+        INVARIANT(state.warm_restarts == 0);
+        INVARIANT(warm_logged == logged && supervisor_starts == starts);
+        return 0;
+    }
+    INVARIANT(state.AvhControlStatus == status && state.AvhControl == AVH_ON);
+    INVARIANT(warm_logged == logged + 1 && supervisor_starts == starts + 1);
+    return 1;
+}
+
+
+// avh_init(): only a warm reset with a sealed state of a running engine takes
+// over, at most AVH_WARM_MAX times until the engine stops
+static void takeover_checks(void)
+{
+    avh_reset();
+    avh_seal();
+    INVARIANT(takeover(RCC_CSR_IWDGRSTF, 0, READY));
+    INVARIANT(state.warm_restarts == 1);
+    INVARIANT(!takeover(RCC_CSR_PORRSTF | RCC_CSR_PINRSTF, 0, READY));
+    INVARIANT(!takeover(RCC_CSR_SFTRSTF, 1, READY));
+    INVARIANT(!takeover(RCC_CSR_SFTRSTF, 0, ENGINE_STOP));
+
+    for(uint8_t i = 1; i <= AVH_WARM_MAX; i++){
+        INVARIANT(takeover(RCC_CSR_IWDGRSTF, 0, READY));
+        INVARIANT(state.warm_restarts == i);
+    }
+    INVARIANT(!takeover(RCC_CSR_IWDGRSTF, 0, READY));
+    INVARIANT(takeover(RCC_CSR_IWDGRSTF, 0, READY));
+    fprintf(stdout, "fuzz_avh: warm restart takeover checks passed\n");
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t buf[64 * 1024];
+
+    takeover_checks();
+
+    if(argc > 1){
+        for(int i = 1; i < argc; i++){
+            FILE *f = fopen(argv[i], "rb");
+            if(f == NULL){
+                perror(argv[i]);
+                return 1;
+            }
+            size_t len = fread(buf, 1, sizeof(buf), f);
+            fclose(f);
+            LLVMFuzzerTestOneInput(buf, len);
+        }
+        return 0;
+    }
+
+    srand(1);
+    for(uint32_t n = 0; n < FUZZ_ITERATIONS; n++){
+        size_t len = 1 + FUZZ_RECORD * (rand() % 64);
+
+        // Mostly known IDs, well formed frames and zero bytes, to get past the
+        // early returns and reach the standstill conditions
+        for(size_t i = 0; i < len; i++)
+            buf[i] = (rand() % 2) ? rand() : 0;
+        for(size_t i = 1; i + FUZZ_RECORD <= len; i += FUZZ_RECORD){
+            buf[i] %= 9;
+            buf[i + 1] &= (rand() % 8) ? 0x06 : 0xFF;
+            buf[i + 10] %= 50;
+        }
+        LLVMFuzzerTestOneInput(buf, len);
+    }
+    fprintf(stdout, "fuzz_avh: %u random inputs, invariants held\n", FUZZ_ITERATIONS);
+    return 0;
+}
+#endif
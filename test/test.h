@@ -0,0 +1,63 @@
+#ifndef _TEST_H
+#define _TEST_H
+
+#include <stdint.h>
+#include "stm32f0xx_hal.h"
+#include "usbd_cdc_if.h"
+
+
+// Checks: a failed check is reported and counted, the test goes on
+#define CHECK(cond) test_check((cond) != 0, #cond, __FILE__, __LINE__)
+#define CHECK_EQ(a, b) test_check_eq((int64_t)(a), (int64_t)(b), #a " == " #b, __FILE__, __LINE__)
+
+// Run a test case
+#define RUN(fn) test_run(#fn, fn)
+
+
+// Fake peripheral state (test/fake_hal.c)
+extern uint32_t fake_tick;            // HAL_GetTick()
+extern uint32_t fake_tick_step;       // Added to fake_tick on every HAL_GetTick() call
+extern uint32_t fake_can_free;        // Free TX mailboxes
+extern HAL_StatusTypeDef fake_can_add_status;
+extern uint32_t fake_can_sent;        // Frames handed to HAL_CAN_AddTxMessage()
+extern CAN_TxHeaderTypeDef fake_can_last_header;
+extern uint8_t fake_can_last_data[8];
+extern USBD_HandleTypeDef hUsbDeviceFS;
+extern USBD_CDC_HandleTypeDef fake_cdc;
+extern uint8_t fake_usb_out[4096];    // Bytes passed to USBD_CDC_TransmitPacket()
+extern uint32_t fake_usb_out_len;
+extern uint32_t fake_usb_transfers;
+extern uint8_t fake_usb_busy;         // Leave TxState set after a transfer was started
+extern uint8_t *fake_usb_rx_buf;      // Last buffer given to USBD_CDC_SetRxBuffer()
+extern uint32_t fake_usb_rx_armed;    // USBD_CDC_ReceivePacket() calls
+extern uint8_t fake_parse_buf[512];   // Bytes passed to avhcontroller_parse()
+extern uint32_t fake_parse_len;
+extern uint32_t fake_parse_calls;
+extern uint32_t fake_system_init_calls; // system_init()
+extern uint32_t fake_clock_restores;    // system_clock_restore()
+
+void fake_reset(void);
+void fake_can_frame(uint32_t id, uint8_t ext, uint8_t rtr, uint8_t dlc, const uint8_t *data);
+int8_t fake_usb_packet(const uint8_t *data, uint32_t len);
+uint32_t fake_random(void);
+
+
+// Module state resets (the test files include the modules under test)
+void test_can_reset(void);
+void test_cdc_reset(void);
+void test_error_reset(void);
+
+
+// Runner
+void test_reset(void);
+void test_check(int ok, const char *expr, const char *file, int line);
+void test_check_eq(int64_t a, int64_t b, const char *expr, const char *file, int line);
+void test_run(const char *name, void (*fn)(void));
+
+void test_can(void);
+void test_cdc(void);
+void test_error(void);
+void test_usb(void);
+void bench_queues(void);
+
+#endif // _TEST_H
@@ -0,0 +1,282 @@
+//
+// test_can: TX queue, RX ring and RX interrupt of can.c against the fake bxCAN
+//
+// can.c is included, so the tests can reset and inspect its private state.
+//
+
+#include <string.h>
+#include "test.h"
+#include "../src/can.c"
+
+
+// Back to the state after reset: queues empty, off bus, default bit timing
+void test_can_reset(void)
+{
+    memset(&txqueue, 0, sizeof(txqueue));
+    memset((void *)&rxring, 0, sizeof(rxring));
+    bus_state = OFF_BUS;
+    can_mode = CAN_MODE_NORMAL;
+    can_autoretransmit = ENABLE;
+    filter_accept_all = 0;
+    can_init();
+}
+
+
+// Queue a standard data frame carrying a 16-bit sequence number
+static uint32_t queue_frame(uint16_t id, uint16_t seq)
+{
+    CAN_TxHeaderTypeDef header = { .StdId = id, .IDE = CAN_ID_STD, .RTR = CAN_RTR_DATA, .DLC = 8 };
+    uint8_t data[8] = { seq >> 8, seq, 0x55, 0xAA, 0, 0, 0, 0 };
+
+    return can_tx(&header, data);
+}
+
+
+// Receive a standard data frame carrying a 16-bit sequence number
+static void receive_frame(uint16_t seq)
+{
+    uint8_t data[8] = { seq >> 8, seq };
+
+    fake_can_frame(CAN_ID_SPEED, 0, 0, 8, data);
+}
+
+
+// The TX queue holds TXQUEUE_LEN - 1 frames (one slot is kept free), then refuses
+static void can_tx_queue_full(void)
+{
+    uint16_t queued = 0;
+
+    while(queue_frame(0x100, queued) == HAL_OK && queued < TXQUEUE_LEN)
+        queued++;
+
+    CHECK_EQ(queued, TXQUEUE_LEN - 1);
+    CHECK(error_occurred(ERR_FULLBUF_CANTX));
+
+    fake_can_free = 0;
+    can_process();
+    CHECK_EQ(fake_can_sent, 0);
+
+    for(uint16_t i = 0; i < queued; i++){
+        fake_can_free = 1;
+        can_process();
+        CHECK_EQ(fake_can_sent, i + 1);
+        CHECK_EQ(fake_can_last_data[0] << 8 | fake_can_last_data[1], i);
+    }
+    fake_can_free = 3;
+    can_process();
+    CHECK_EQ(fake_can_sent, queued);
+}
+
+
+// Frames leave the TX queue in order across many wraparounds, one per can_process()
+static void can_tx_queue_order(void)
+{
+    uint16_t seq = 0;
+
+    for(uint16_t round = 0; round < 3 * TXQUEUE_LEN; round++){
+        for(uint8_t i = 0; i < 5; i++)
+            CHECK_EQ(queue_frame(0x100 + i, seq + i), HAL_OK);
+
+        for(uint8_t i = 0; i < 5; i++){
+            fake_can_free = 3;
+            can_process();
+            CHECK_EQ(fake_can_last_header.StdId, 0x100 + i);
+            CHECK_EQ(fake_can_last_data[0] << 8 | fake_can_last_data[1], seq);
+            seq++;
+        }
+    }
+    CHECK_EQ(fake_can_sent, seq);
+    CHECK(!error_occurred(ERR_FULLBUF_CANTX));
+}
+
+
+// A frame the HAL refuses is dropped and flagged, the queue moves on
+static void can_tx_fail(void)
+{
+    queue_frame(0x100, 1);
+    queue_frame(0x100, 2);
+
+    fake_can_add_status = HAL_ERROR;
+    can_process();
+    CHECK(error_occurred(ERR_CAN_TXFAIL));
+
+    fake_can_add_status = HAL_OK;
+    can_process();
+    CHECK_EQ(fake_can_sent, 1);
+    CHECK_EQ(fake_can_last_data[1], 2);
+}
+
+
+// The RX interrupt decodes the FIFO mailbox into the ring, can_rx() hands it out
+static void can_rx_decode(void)
+{
+    CAN_RxHeaderTypeDef header;
+    uint8_t std_data[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    uint8_t ext_data[8] = { 0 };
+    uint8_t data[8];
+
+    can_enable();
+    CHECK(!is_can_msg_pending(CAN_RX_FIFO0));
+    CHECK_EQ(can_rx(&header, data), HAL_ERROR);
+
+    fake_tim2.CNT = 1234;
+    fake_can_frame(CAN_ID_SPEED, 0, 0, 8, std_data);
+    fake_tim2.CNT = 1300;
+    fake_can_frame(0x18DAF110, 1, 1, 0, ext_data);
+    CHECK_EQ(can_rx_depth(), 2);
+    CHECK(is_can_msg_pending(CAN_RX_FIFO0));
+
+    CHECK_EQ(can_rx(&header, data), HAL_OK);
+    CHECK_EQ(header.StdId, CAN_ID_SPEED);
+    CHECK_EQ(header.ExtId, 0);
+    CHECK_EQ(header.IDE, CAN_ID_STD);
+    CHECK_EQ(header.RTR, CAN_RTR_DATA);
+    CHECK_EQ(header.DLC, 8);
+    CHECK_EQ(header.Timestamp, 1234);
+    CHECK(memcmp(data, std_data, sizeof(data)) == 0);
+
+    CHECK_EQ(can_rx(&header, data), HAL_OK);
+    CHECK_EQ(header.StdId, 0);
+    CHECK_EQ(header.ExtId, 0x18DAF110);
+    CHECK_EQ(header.IDE, CAN_ID_EXT);
+    CHECK_EQ(header.RTR, CAN_RTR_REMOTE);
+    CHECK_EQ(header.DLC, 0);
+
+    CHECK(!is_can_msg_pending(CAN_RX_FIFO0));
+
+    // Nothing is pending while off bus
+    receive_frame(1);
+    can_disable();
+    CHECK(!is_can_msg_pending(CAN_RX_FIFO0));
+}
+
+
+// The RX ring holds RXRING_LEN - 1 frames, further frames are released from the
+// FIFO, counted and flagged, and the buffered ones stay in order
+static void can_rx_ring_full(void)
+{
+    CAN_RxHeaderTypeDef header;
+    uint8_t data[8];
+
+    can_enable();
+    for(uint16_t i = 0; i < RXRING_LEN + 4; i++)
+        receive_frame(i);
+
+    CHECK_EQ(can_rx_depth(), RXRING_LEN - 1);
+    CHECK_EQ(can_rx_dropped(), 5);
+    CHECK(error_occurred(ERR_FULLBUF_CANRX));
+
+    for(uint16_t i = 0; i < RXRING_LEN - 1; i++){
+        CHECK_EQ(can_rx(&header, data), HAL_OK);
+        CHECK_EQ(data[0] << 8 | data[1], i);
+    }
+    CHECK_EQ(can_rx(&header, data), HAL_ERROR);
+}
+
+
+// A hardware FIFO overrun is flagged
+static void can_rx_fifo_overrun(void)
+{
+    fake_can.RF0R = CAN_RF0R_FOVR0;
+    can_rx_isr();
+    CHECK(error_occurred(ERR_CANRXFIFO_OVERFLOW));
+    CHECK_EQ(can_rx_depth(), 0);
+}
+
+
+// Error interrupt: the last error code is counted and re-armed, the state tracked
+static void can_error_isr(void)
+{
+    can_enable();
+    fake_can.MSR = CAN_MSR_ERRI;
+    fake_can.ESR = (130U << CAN_ESR_TEC_Pos) | CAN_ESR_EPVF | CAN_ESR_EWGF | (3U << CAN_ESR_LEC_Pos);
+    can_rx_isr();
+
+    CHECK(error_can_passive());
+    CHECK(error_occurred(ERR_CAN_PASSIVE));
+    CHECK_EQ(fake_can.ESR & CAN_ESR_LEC, CAN_ESR_LEC);
+
+    // Back to error active: only seen by the main loop sample
+    fake_can.ESR = CAN_ESR_LEC;
+    can_error_sample();
+    CHECK(!error_can_passive());
+}
+
+
+// Compile-time bit timing reaches the peripheral, direct timing is range checked
+static void can_bit_timing(void)
+{
+    CAN_HandleTypeDef *handle = can_gethandle();
+
+    can_set_bitrate(CAN_BITRATE_500K);
+    can_enable();
+    CHECK_EQ(handle->Init.Prescaler, 6);
+    CHECK_EQ(handle->Init.TimeSeg1, (13 - 1) << CAN_BTR_TS1_Pos);
+    CHECK_EQ(handle->Init.TimeSeg2, (2 - 1) << CAN_BTR_TS2_Pos);
+    CHECK_EQ(handle->Init.SyncJumpWidth, (2 - 1) << CAN_BTR_SJW_Pos);
+    CHECK_EQ(handle->Init.Mode, CAN_MODE_NORMAL);
+
+    // Not while on bus
+    CHECK_EQ(can_set_bittiming(12, 13, 2, 1), -1);
+    can_disable();
+
+    CHECK_EQ(can_set_bittiming(0, 13, 2, 1), -1);
+    CHECK_EQ(can_set_bittiming(CAN_BRP_MAX + 1, 13, 2, 1), -1);
+    CHECK_EQ(can_set_bittiming(12, CAN_TSEG1_MAX + 1, 2, 1), -1);
+    CHECK_EQ(can_set_bittiming(12, 13, CAN_TSEG2_MAX + 1, 1), -1);
+    CHECK_EQ(can_set_bittiming(12, 13, 2, 3), -1);
+    CHECK_EQ(can_set_bittiming(12, 13, 2, 1), 0);
+
+    can_set_loopback(1);
+    can_enable();
+    CHECK_EQ(handle->Init.Prescaler, 12);
+    CHECK_EQ(handle->Init.SyncJumpWidth, 0);
+    CHECK_EQ(handle->Init.Mode, CAN_MODE_SILENT_LOOPBACK);
+}
+
+
+// Random bursts of RX interrupts between random main loop reads: frames come
+// out in order, and every frame is either received or counted as dropped
+static void can_rx_interleaved(void)
+{
+    CAN_RxHeaderTypeDef header;
+    uint8_t data[8];
+    uint32_t produced = 0;
+    uint32_t received = 0;
+    int32_t last = -1;
+
+    can_enable();
+    for(uint32_t step = 0; step < 20000; step++){
+        uint8_t burst = fake_random() % (RXRING_LEN / 4);
+        uint8_t reads = fake_random() % (RXRING_LEN / 4 + 1); // The main loop drains a little faster on average
+
+        for(uint8_t i = 0; i < burst; i++)
+            receive_frame(produced++);
+
+        for(uint8_t i = 0; i < reads && can_rx(&header, data) == HAL_OK; i++){
+            uint16_t seq = data[0] << 8 | data[1];
+            CHECK(last < 0 || (int16_t)(seq - last) > 0);
+            last = seq;
+            received++;
+        }
+    }
+    while(can_rx(&header, data) == HAL_OK)
+        received++;
+
+    CHECK_EQ(received + can_rx_dropped(), produced);
+    CHECK(can_rx_dropped() < produced / 100);
+}
+
+
+void test_can(void)
+{
+    RUN(can_tx_queue_full);
+    RUN(can_tx_queue_order);
+    RUN(can_tx_fail);
+    RUN(can_rx_decode);
+    RUN(can_rx_ring_full);
+    RUN(can_rx_fifo_overrun);
+    RUN(can_error_isr);
+    RUN(can_bit_timing);
+    RUN(can_rx_interleaved);
+}
@@ -0,0 +1,190 @@
+//
+// test_cdc: USB RX FIFO, batched TX ring and CDC_Transmit_FS of usbd_cdc_if.c
+// against the fake USB device library
+//
+// usbd_cdc_if.c is included, so the tests can reset its private state.
+//
+
+#include <string.h>
+#include "test.h"
+#include "../src/usbd_cdc_if.c"
+
+
+// Back to the state after USB enumeration: FIFO and ring empty, first RX buffer armed
+void test_cdc_reset(void)
+{
+    memset((void *)&rxbuf, 0, sizeof(rxbuf));
+    txring_head = 0;
+    txring_tail = 0;
+    txring_inflight = 0;
+    USBD_Interface_fops_FS.Init();
+}
+
+
+// Packets reach the command parser in order, one per cdc_process()
+static void cdc_rx_fifo(void)
+{
+    CHECK(!cdc_rx_pending());
+
+    CHECK_EQ(fake_usb_packet((const uint8_t *)"V\n", 2), USBD_OK);
+    CHECK_EQ(fake_usb_packet((const uint8_t *)"C 1 2\n", 6), USBD_OK);
+    CHECK_EQ(fake_usb_rx_armed, 2);
+    CHECK(cdc_rx_pending());
+
+    cdc_process();
+    CHECK_EQ(fake_parse_calls, 1);
+    CHECK_EQ(fake_parse_len, 2);
+    cdc_process();
+    cdc_process();
+    CHECK_EQ(fake_parse_calls, 2);
+    CHECK(memcmp(fake_parse_buf, "V\nC 1 2\n", 8) == 0);
+    CHECK(!cdc_rx_pending());
+}
+
+
+// The FIFO holds NUM_RX_BUFS - 1 packets (one buffer is always armed). On
+// overflow the armed buffer is reused, so queued packets are not overwritten.
+static void cdc_rx_full(void)
+{
+    char packet[2] = { 'a', '\n' };
+
+    for(uint8_t i = 0; i < NUM_RX_BUFS - 1; i++){
+        packet[0] = 'a' + i;
+        CHECK_EQ(fake_usb_packet((const uint8_t *)packet, 2), USBD_OK);
+    }
+    CHECK(!error_occurred(ERR_FULLBUF_USBRX));
+
+    uint8_t *armed = fake_usb_rx_buf;
+    CHECK_EQ(fake_usb_packet((const uint8_t *)"X\n", 2), HAL_ERROR);
+    CHECK(error_occurred(ERR_FULLBUF_USBRX));
+    CHECK(fake_usb_rx_buf == armed);
+    CHECK_EQ(fake_usb_rx_armed, NUM_RX_BUFS);
+
+    while(cdc_rx_pending())
+        cdc_process();
+    CHECK_EQ(fake_parse_calls, NUM_RX_BUFS - 1);
+    CHECK(memcmp(fake_parse_buf, "a\nb\nc\nd\ne\n", 2 * (NUM_RX_BUFS - 1)) == 0);
+}
+
+
+// The TX ring takes TX_RING_SIZE - 1 bytes, whole writes only, and sends them in
+// contiguous transfers of at most TX_RING_MAX_XFER bytes, one at a time
+static void cdc_tx_ring(void)
+{
+    uint8_t data[TX_RING_SIZE];
+
+    for(uint16_t i = 0; i < sizeof(data); i++)
+        data[i] = i * 7;
+
+    CHECK_EQ(cdc_tx_write(data, TX_RING_SIZE), 0);
+    CHECK_EQ(cdc_tx_write(data, TX_RING_SIZE - 1), TX_RING_SIZE - 1);
+    CHECK_EQ(cdc_tx_write(data, 1), 0);
+    CHECK_EQ(cdc_tx_putc('x'), 0);
+
+    fake_usb_busy = 1;
+    cdc_tx_process();
+    CHECK_EQ(fake_usb_transfers, 1);
+    CHECK_EQ(fake_usb_out_len, TX_RING_MAX_XFER);
+
+    // Previous transfer in flight: nothing released, nothing sent
+    cdc_tx_process();
+    CHECK_EQ(fake_usb_transfers, 1);
+    CHECK_EQ(cdc_tx_putc('x'), 0);
+
+    fake_cdc.TxState = 0;
+    cdc_tx_process();
+    CHECK_EQ(fake_usb_transfers, 2);
+    CHECK_EQ(fake_usb_out_len, TX_RING_SIZE - 1);
+    CHECK(memcmp(fake_usb_out, data, TX_RING_SIZE - 1) == 0);
+
+    // Wraps: the part up to the end of the ring first, then the rest
+    fake_cdc.TxState = 0;
+    fake_usb_out_len = 0;
+    CHECK_EQ(cdc_tx_write(data, 100), 100);
+    cdc_tx_process();
+    CHECK_EQ(fake_usb_out_len, 1);
+    fake_cdc.TxState = 0;
+    cdc_tx_process();
+    CHECK_EQ(fake_usb_out_len, 100);
+    CHECK(memcmp(fake_usb_out, data, 100) == 0);
+}
+
+
+// Direct transmit: too long is refused, a busy endpoint times out after 10 ms
+static void cdc_transmit(void)
+{
+    uint8_t data[TX_BUF_SIZE + 1] = "hello";
+
+    CHECK_EQ(CDC_Transmit_FS(data, sizeof(data)), 0);
+
+    CHECK_EQ(CDC_Transmit_FS(data, 5), USBD_OK);
+    CHECK_EQ(fake_usb_out_len, 5);
+    CHECK(memcmp(fake_usb_out, "hello", 5) == 0);
+
+    fake_cdc.TxState = 1;
+    fake_tick_step = 1;
+    CHECK_EQ(CDC_Transmit_FS(data, 5), USBD_BUSY);
+    CHECK(error_occurred(ERR_USBTX_BUSY));
+    CHECK(fake_tick >= 10);
+    CHECK_EQ(fake_usb_transfers, 1);
+}
+
+
+// Line coding reported to the host: 115200 8N1
+static void cdc_line_coding(void)
+{
+    uint8_t coding[7] = { 0 };
+
+    USBD_Interface_fops_FS.Control(CDC_GET_LINE_CODING, coding, sizeof(coding));
+    CHECK_EQ(coding[0] | coding[1] << 8 | coding[2] << 16, 115200);
+    CHECK_EQ(coding[4], 0);
+    CHECK_EQ(coding[5], 0);
+    CHECK_EQ(coding[6], 8);
+}
+
+
+// Random bursts of OUT packets between random main loop passes: packets are
+// parsed in order, and every packet is either parsed or refused
+static void cdc_rx_interleaved(void)
+{
+    uint32_t produced = 0;
+    uint32_t refused = 0;
+    uint32_t parsed = 0;
+    uint8_t last = 0;
+
+    for(uint32_t step = 0; step < 20000; step++){
+        uint8_t burst = fake_random() % 4;
+        uint8_t passes = fake_random() % 4;
+
+        for(uint8_t i = 0; i < burst; i++){
+            uint8_t seq = produced++;
+            if(fake_usb_packet(&seq, 1) != USBD_OK)
+                refused++;
+        }
+        for(uint8_t i = 0; i < passes && cdc_rx_pending(); i++){
+            fake_parse_len = 0;
+            cdc_process();
+            CHECK_EQ(fake_parse_len, 1);
+            CHECK(parsed == 0 || (int8_t)(fake_parse_buf[0] - last) > 0);
+            last = fake_parse_buf[0];
+            parsed++;
+        }
+    }
+    while(cdc_rx_pending()){
+        cdc_process();
+        parsed++;
+    }
+
+    CHECK_EQ(parsed + refused, produced);
+}
+
+
+void test_cdc(void)
+{
+    RUN(cdc_rx_fifo);
+    RUN(cdc_rx_full);
+    RUN(cdc_tx_ring);
+    RUN(cdc_transmit);
+    RUN(cdc_line_coding);
+    RUN(cdc_rx_interleaved);
+}
@@ -0,0 +1,103 @@
+//
+// test_error: error register and bxCAN error state tracking of error.c
+//
+// error.c is included, so the tests can reset its private state.
+//
+
+#include <string.h>
+#include "test.h"
+#include "../src/error.c"
+
+
+// Back to the state after boot: no errors, error active
+void test_error_reset(void)
+{
+    err_reg = 0;
+    memset(err_time, 0, sizeof(err_time));
+    memset(&can_err, 0, sizeof(can_err));
+}
+
+
+// An asserted error sets its bit and timestamp, unknown errors are ignored
+static void error_assert_records(void)
+{
+    fake_tick = 42;
+    error_assert(ERR_CAN_TXFAIL);
+    CHECK(error_occurred(ERR_CAN_TXFAIL));
+    CHECK(!error_occurred(ERR_USBTX_BUSY));
+    CHECK_EQ(error_timestamp(ERR_CAN_TXFAIL), 42);
+    CHECK_EQ(error_reg(), 1 << ERR_CAN_TXFAIL);
+
+    error_assert(ERR_MAX);
+    CHECK_EQ(error_reg(), 1 << ERR_CAN_TXFAIL);
+    CHECK(!error_occurred(ERR_MAX));
+    CHECK_EQ(error_timestamp(ERR_MAX), 0);
+}
+
+
+// Fault confinement states from CAN_ESR: transitions are counted once, the
+// bus-off duration is measured on recovery
+static void error_can_states(void)
+{
+    error_can_state((100U << CAN_ESR_TEC_Pos) | CAN_ESR_EWGF);
+    CHECK_EQ(can_err.state, CAN_ERR_WARNING);
+    CHECK(!error_can_passive());
+
+    error_can_state((130U << CAN_ESR_TEC_Pos) | CAN_ESR_EPVF | CAN_ESR_EWGF);
+    error_can_state((140U << CAN_ESR_TEC_Pos) | CAN_ESR_EPVF | CAN_ESR_EWGF);
+    CHECK(error_can_passive());
+    CHECK_EQ(can_err.passive, 1);
+    CHECK_EQ(can_err.tec_max, 140);
+    CHECK(error_occurred(ERR_CAN_PASSIVE));
+
+    fake_tick = 100;
+    error_can_state(CAN_ESR_BOFF | CAN_ESR_EPVF | CAN_ESR_EWGF);
+    CHECK_EQ(can_err.state, CAN_ERR_BUSOFF);
+    CHECK_EQ(can_err.busoff, 1);
+    CHECK(error_occurred(ERR_CAN_BUSOFF));
+
+    fake_tick = 350;
+    error_can_state(0);
+    CHECK_EQ(can_err.state, CAN_ERR_ACTIVE);
+    CHECK_EQ(can_err.recovery, 250);
+    CHECK_EQ(can_err.passive, 1);
+    CHECK(!error_can_passive());
+}
+
+
+// Last error codes 1..6 are counted, 0 (none) and 7 (unchanged) are not
+static void error_can_lec_count(void)
+{
+    for(uint8_t lec = 0; lec <= 7; lec++)
+        error_can_lec(lec);
+    error_can_lec(3);
+
+    CHECK_EQ(can_err.lec[0], 1);
+    CHECK_EQ(can_err.lec[2], 2);
+    CHECK_EQ(can_err.lec[5], 1);
+}
+
+
+// The E report goes through printf_ and the USB TX ring
+static void error_can_report_line(void)
+{
+    static const char expected[] =
+        "E P since:10 tec:130/130 rec:0/0 passive:1 busoff:0 recovery:0 lec:0,0,1,0,0,0 reg:00000100\n";
+
+    error_can_lec(3);
+    error_can_state((130U << CAN_ESR_TEC_Pos) | CAN_ESR_EPVF | CAN_ESR_EWGF);
+    fake_tick = 10;
+    error_can_report();
+
+    CHECK_EQ(fake_usb_out_len, sizeof(expected) - 1);
+    CHECK(memcmp(fake_usb_out, expected, sizeof(expected) - 1) == 0);
+}
+
+
+void test_error(void)
+{
+    RUN(error_assert_records);
+    RUN(error_can_states);
+    RUN(error_can_lec_count);
+    RUN(error_can_report_line);
+}
@@ -0,0 +1,67 @@
+//
+// test_main: host unit tests of the driver level modules (make test)
+//
+// Every test case starts from power-on state of the fakes and of the modules
+// under test. The queue benchmarks run after the tests.
+//
+
+#include <stdio.h>
+#include "test.h"
+
+
+// Private variables
+static const char *current = "";
+static uint32_t checks = 0;
+static uint32_t failed = 0;
+
+
+// Count a check, report it if it failed
+void test_check(int ok, const char *expr, const char *file, int line)
+{
+    checks++;
+    if(!ok){
+        failed++;
+        printf("FAIL %s: %s (%s:%d)\n", current, expr, file, line);
+    }
+}
+
+
+// Count a check of two values, report both if they differ
+void test_check_eq(int64_t a, int64_t b, const char *expr, const char *file, int line)
+{
+    test_check(a == b, expr, file, line);
+    if(a != b)
+        printf("     %lld != %lld\n", (long long)a, (long long)b);
+}
+
+
+// Fakes and modules under test back to power-on state
+void test_reset(void)
+{
+    fake_reset();
+    test_error_reset();
+    test_can_reset();
+    test_cdc_reset();
+}
+
+
+// Run a test case from a clean state
+void test_run(const char *name, void (*fn)(void))
+{
+    current = name;
+    test_reset();
+    fn();
+}
+
+
+int main(void)
+{
+    test_can();
+    test_cdc();
+    test_error();
+    test_usb();
+    printf("%u checks, %u failed\n", checks, failed);
+
+    bench_queues();
+    return failed ? 1 : 0;
+}
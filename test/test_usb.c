@@ -0,0 +1,116 @@
+//
+// test_usb: USB suspend/resume callbacks of usbd_conf.c against the fake PCD
+// driver and the fake bxCAN
+//
+// usbd_conf.c is included, so the tests can reach its PCD handle. The clock
+// switch of system_clock_restore() waits on RCC ready bits and is not modelled;
+// the fake counts the calls.
+//
+
+#include <string.h>
+#include "test.h"
+#include "can.h"
+#include "subaru_levorg_vnx.h"
+#include "../src/usbd_conf.c"
+
+
+// Back to the state after usb_init(): PCD linked to the device, configured
+static void usb_reset(void)
+{
+    memset(&hpcd_USB_FS, 0, sizeof(hpcd_USB_FS));
+    USBD_LL_Init(&hUsbDeviceFS);
+    hUsbDeviceFS.dev_state = USBD_STATE_CONFIGURED;
+}
+
+
+// Queue a standard data frame carrying a sequence number
+static void queue_frame(uint8_t seq)
+{
+    CAN_TxHeaderTypeDef header = { .StdId = 0x100, .IDE = CAN_ID_STD, .RTR = CAN_RTR_DATA, .DLC = 8 };
+    uint8_t data[8] = { seq };
+
+    CHECK_EQ(can_tx(&header, data), HAL_OK);
+}
+
+
+// Receive a standard data frame carrying a sequence number
+static void receive_frame(uint8_t seq)
+{
+    uint8_t data[8] = { seq };
+
+    fake_can_frame(CAN_ID_SPEED, 0, 0, 8, data);
+}
+
+
+// Suspend with frames in both CAN queues, time passes, resume: the tick goes on
+// from where it was, SysTick and the HAL are left alone, and the queued frames
+// come out in order afterwards
+static void suspend_resume(uint8_t low_power)
+{
+    CAN_RxHeaderTypeDef header;
+    uint8_t data[8];
+    SysTick_Type systick;
+
+    usb_reset();
+    hpcd_USB_FS.Init.low_power_enable = low_power;
+    can_enable();
+    fake_systick.CTRL = SysTick_CTRL_ENABLE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_CLKSOURCE_Msk;
+    memcpy(&systick, &fake_systick, sizeof(systick));
+
+    fake_tick = 1000;
+    for(uint8_t i = 0; i < 3; i++){
+        queue_frame(i);
+        receive_frame(i);
+    }
+
+    uint32_t before = HAL_GetTick();
+    HAL_PCD_SuspendCallback(&hpcd_USB_FS);
+    CHECK_EQ(hUsbDeviceFS.dev_state, USBD_STATE_SUSPENDED);
+    CHECK_EQ((fake_scb.SCR & SCB_SCR_SLEEPDEEP_Msk) != 0, low_power);
+
+    fake_tick += 3000;
+    HAL_PCD_ResumeCallback(&hpcd_USB_FS);
+    CHECK_EQ(hUsbDeviceFS.dev_state, USBD_STATE_CONFIGURED);
+    CHECK_EQ(fake_scb.SCR & (SCB_SCR_SLEEPDEEP_Msk | SCB_SCR_SLEEPONEXIT_Msk), 0);
+    CHECK_EQ(fake_clock_restores, low_power);
+
+    CHECK(HAL_GetTick() >= before + 3000);
+    CHECK_EQ(fake_system_init_calls, 0);
+    CHECK(memcmp(&systick, &fake_systick, sizeof(systick)) == 0);
+
+    for(uint8_t i = 0; i < 3; i++){
+        CHECK_EQ(can_rx(&header, data), HAL_OK);
+        CHECK_EQ(data[0], i);
+
+        can_process();
+        CHECK_EQ(fake_can_sent, i + 1);
+        CHECK_EQ(fake_can_last_data[0], i);
+    }
+    CHECK_EQ(can_rx(&header, data), HAL_ERROR);
+
+    // Still receiving after resume
+    receive_frame(3);
+    CHECK_EQ(can_rx(&header, data), HAL_OK);
+    CHECK_EQ(data[0], 3);
+}
+
+
+// Configuration of usbd_conf.c: suspend does not enter Stop mode
+static void usb_suspend_resume(void)
+{
+    suspend_resume(DISABLE);
+}
+
+
+// Low power suspend: Stop mode on suspend, only the clock restored on resume
+static void usb_suspend_resume_low_power(void)
+{
+    suspend_resume(ENABLE);
+}
+
+
+void test_usb(void)
+{
+    RUN(usb_suspend_resume);
+    RUN(usb_suspend_resume_low_power);
+}
@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+#
+# crash_symbolize: resolve the crash record of the AVH controller to source
+#
+# Usage:
+#   crash_symbolize.py build/AVHController-xxx.elf /dev/ttyACM0   (sends 'F')
+#   crash_symbolize.py build/AVHController-xxx.map capture.txt    (F line or J journal lines)
+#
+# With an .elf, arm-none-eabi-addr2line gives function, file and line. With a
+# .map (or without addr2line on the PATH) only the enclosing function is shown.
+# Use the build of the firmware that crashed.
+#
+
+import re
+import shutil
+import subprocess
+import sys
+
+FLASH_BASE = 0x08000000
+SRAM_BASE = 0x20000000
+
+# Journal event IDs, keep in sync with enum journal_event in inc/journal.h
+EVT_FAULT = 0x0D
+EVT_FAULT_PC = 0x0E
+EVT_FAULT_LR = 0x0F
+
+SOURCES = {1: "HardFault", 2: "NMI"}
+
+
+def read_lines(source):
+    if source.startswith("/dev/") or source.upper().startswith("COM"):
+        import serial
+        with serial.Serial(source, 115200, timeout=2) as port:
+            port.write(b"F\r")
+            line = port.readline().decode("ascii", "replace")
+            if line:
+                yield line
+    else:
+        with open(source) as f:
+            yield from f
+
+
+def parse_records(lines):
+    """Yield dicts with src/pc/lr (and more for F lines), oldest first"""
+    fault = None
+    for line in lines:
+        line = line.strip()
+        if line.startswith("F src:"):
+            yield {k: int(v, 16) if k != "tick" and k != "src" else int(v)
+                   for k, v in (f.split(":") for f in line[2:].split())}
+        elif line.startswith("J") and not line.startswith("J end") and len(line) >= 15:
+            event, a, b = int(line[9:11], 16), int(line[11:13], 16), int(line[13:15], 16)
+            if event == EVT_FAULT:
+                fault = {"src": a & 0x7F, "err": b, "ram": bool(a & 0x80)}
+            elif event == EVT_FAULT_PC and fault is not None:
+                fault["pc"] = (SRAM_BASE if fault["ram"] else FLASH_BASE) | (a << 8) | b
+            elif event == EVT_FAULT_LR and fault is not None:
+                # Bit 0 is the Thumb bit, the region is not recorded: assume flash
+                fault["lr"] = FLASH_BASE | (a << 8) | b
+                yield fault
+                fault = None
+
+
+def map_symbols(path):
+    symbols = []
+    with open(path) as f:
+        for line in f:
+            m = re.match(r"^\s+0x([0-9a-fA-F]{8,16})\s+([A-Za-z_]\w*)\s*$", line)
+            if m:
+                symbols.append((int(m.group(1), 16), m.group(2)))
+    return sorted(symbols)
+
+
+def resolve_map(symbols, addr):
+    best = None
+    for start, name in symbols:
+        if start > addr:
+            break
+        best = (start, name)
+    return "%s+0x%X" % (best[1], addr - best[0]) if best else "??"
+
+
+def resolve(image, addr, symbols):
+    addr &= ~1
+    addr2line = shutil.which("arm-none-eabi-addr2line")
+    if image.endswith(".elf") and addr2line:
+        out = subprocess.run([addr2line, "-f", "-C", "-e", image, "0x%08X" % addr],
+                             capture_output=True, text=True).stdout.split("\n")
+        return "%s at %s" % (out[0], out[1] if len(out) > 1 else "??")
+    return resolve_map(symbols, addr)
+
+
+def main():
+    if len(sys.argv) != 3:
+        print("usage: crash_symbolize.py <elf|map> <port|file>", file=sys.stderr)
+        return 1
+    image = sys.argv[1]
+    symbols = map_symbols(image) if image.endswith(".map") else []
+    if not symbols and not shutil.which("arm-none-eabi-addr2line"):
+        symbols = map_symbols(re.sub(r"\.elf$", ".map", image))
+
+    found = False
+    for rec in parse_records(read_lines(sys.argv[2])):
+        found = True
+        print("%s err:0x%X%s" % (SOURCES.get(rec["src"], "src %d" % rec["src"]), rec["err"],
+                                 " tick:%d" % rec["tick"] if "tick" in rec else ""))
+        print("  pc 0x%08X %s" % (rec["pc"], resolve(image, rec["pc"], symbols)))
+        print("  lr 0x%08X %s" % (rec["lr"], resolve(image, rec["lr"], symbols)))
+        if "sp" in rec:
+            print("  sp 0x%08X psr 0x%08X" % (rec["sp"], rec["psr"]))
+    if not found:
+        print("no crash record")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+#
+# journal_decode: read back the flash event journal of the AVH controller
+#
+# Usage:
+#   journal_decode.py /dev/ttyACM0      (sends the 'J' command and decodes the reply)
+#   journal_decode.py dump.txt          (decodes a previously captured reply)
+#
+
+import sys
+
+# Keep in sync with enum journal_event in inc/journal.h
+EVENTS = {
+    0x01: ("BOOT", "csr"),
+    0x02: ("ENGINE_START", None),
+    0x03: ("ENGINE_STOP", None),
+    0x04: ("AVH_SUCCEEDED", "avh retry"),
+    0x05: ("AVH_HOLD_RELEASED", "rebrake bybrake"),
+    0x06: ("AVH_OFF_CANCELLED", "retry brake"),
+    0x07: ("AVH_HOLD_FAILED", "rebrake bybrake"),
+    0x08: ("AVH_FAILED", "avh retry"),
+    0x09: ("CONTROL_CANCELLED", None),
+    0x0A: ("CONTROL_RESTARTED", "avh"),
+    0x0B: ("ERROR", "err reg"),
+    0x0C: ("WARM_RESTART", "status restarts"),
+    0x0D: ("FAULT", "src reg"),
+    0x0E: ("FAULT_PC", None),
+    0x0F: ("FAULT_LR", None),
+    0x10: ("AUTOBAUD", "bitrate locked"),
+    0x11: ("AVH_ON_WITHDRAWN", "retry speed"),
+}
+
+ERRORS = ["PERIPHINIT", "USBTX_BUSY", "CAN_TXFAIL", "CANRXFIFO_OVERFLOW",
+          "FULLBUF_CANTX", "FULLBUF_USBRX", "FULLBUF_CANRX", "LOOP_DEADLINE",
+          "CAN_PASSIVE", "CAN_BUSOFF", "FLASH"]
+
+RESET_FLAGS = ["RMVF", "OBL", "PIN", "POR", "SFT", "IWDG", "WWDG", "LPWR"]
+
+
+def decode_line(line):
+    line = line.strip()
+    if not line.startswith("J"):
+        return None
+    if line.startswith("J end"):
+        return "# end of journal, %s event(s) dropped before programming" % line.split()[-1]
+
+    raw = line[1:]
+    tick = int(raw[0:8], 16)
+    event = int(raw[8:10], 16)
+    a = int(raw[10:12], 16)
+    b = int(raw[12:14], 16)
+
+    name, args = EVENTS.get(event, ("UNKNOWN_%02X" % event, "a b"))
+    text = "%10d.%03d %s" % (tick // 1000, tick % 1000, name)
+    if event == 0x01:
+        text += " reset:" + ",".join(f for i, f in enumerate(RESET_FLAGS) if a & (1 << i))
+    elif event == 0x0B:
+        err = ERRORS[a] if a < len(ERRORS) else str(a)
+        text += " %s reg:0x%02X" % (err, b)
+    elif event in (0x0E, 0x0F):
+        text += " 0x%04X" % ((a << 8) | b)
+    elif args:
+        names = args.split()
+        text += " " + " ".join("%s:%d" % (n, v) for n, v in zip(names, (a, b)))
+    return text
+
+
+def read_lines(source):
+    if source.startswith("/dev/") or source.upper().startswith("COM"):
+        import serial
+        with serial.Serial(source, 115200, timeout=2) as port:
+            port.write(b"J\r")
+            while True:
+                line = port.readline().decode("ascii", "replace")
+                if not line:
+                    return
+                yield line
+                if line.startswith("J end"):
+                    return
+    else:
+        with open(source) as f:
+            yield from f
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(__doc__ or "usage: journal_decode.py <port|file>", file=sys.stderr)
+        return 1
+    for line in read_lines(sys.argv[1]):
+        text = decode_line(line)
+        if text:
+            print(text)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+#
+# usb_bench: measure USB CDC IN throughput of the AVH controller to this host
+#
+# Usage:
+#   usb_bench.py /dev/ttyACM0 [KiB]
+#
+# Sends the 'B' command and times the filler stream on the host side.
+#
+
+import sys
+import time
+
+import serial
+
+
+def main():
+    if len(sys.argv) < 2:
+        print("usage: usb_bench.py <port> [KiB]", file=sys.stderr)
+        return 1
+    port_name = sys.argv[1]
+    kib = int(sys.argv[2]) if len(sys.argv) > 2 else 256
+
+    with serial.Serial(port_name, 115200, timeout=2) as port:
+        port.reset_input_buffer()
+        port.write(b"B %d\r" % kib)
+
+        received = 0
+        start = None
+        tail = b""
+        while True:
+            chunk = port.read(4096)
+            if not chunk:
+                print("timeout after %d bytes" % received, file=sys.stderr)
+                return 1
+            if start is None:
+                start = time.monotonic()
+            tail += chunk
+            if b"\nB " in tail and tail.endswith(b"\n"):
+                break
+            received += len(chunk)
+            tail = tail[-64:]
+        elapsed = time.monotonic() - start
+
+        report = tail[tail.index(b"\nB ") + 1:].decode().split()
+        sent, ms, busy = int(report[1]), int(report[2]), int(report[3])
+
+    print("device: %d bytes in %d ms = %.1f KiB/s (%d busy retries)"
+          % (sent, ms, sent / 1024 / max(ms, 1) * 1000, busy))
+    print("host:   %.1f KiB/s" % (sent / 1024 / elapsed))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())